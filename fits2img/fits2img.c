@@ -7,22 +7,39 @@
 
 static const char _versionid_[] __attribute__((unused)) = "$Id: fits2img.c 2636 2014-11-21 18:22:17Z bogdan $";
 
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <glib.h>
 
+#include "p2sc_file.h"
+#include "p2sc_fits.h"
+#include "p2sc_msg.h"
 #include "p2sc_name.h"
+#include "p2sc_parallel.h"
+#include "p2sc_prof.h"
+#include "p2sc_sched.h"
 #include "p2sc_stdlib.h"
+#include "p2sc_watch.h"
 
 #include "swap_color.h"
 #include "swap_file.h"
 #include "swap_file_j2k.h"
+#include "swap_math.h"
 #include "swap_qlook.h"
 
 #include "fitsproc.h"
 
 #define APP_NAME "SWHV"
 
+/* --min-clip/--max-clip: the minimum/maximum of the image, as swap_xfer_*() takes it */
+#define AUTO_CLIP        -1000000
 #define DEF_CLIP_MIN     0
 #define DEF_CLIP_MAX     8191
 #define DEF_GAMMA        2.2
@@ -33,41 +50,1000 @@ static const char _versionid_[] __attribute__((unused)) = "$Id: fits2img.c 2636
 #define DEF_PRECINCTW    128
 #define DEF_PRECINCTH    128
 #define DEF_STRATEGY     3
+#define DEF_MAX_INFLIGHT (1LL << 30)
+#define DEF_IO_JOBS      2
+
+/* on each output: input DATASUM/CHECKSUM, size, mtime and inode, and the hash of the options */
+#define CACHE_XATTR "user.fits2img.key"
+
+/* --profile report */
+enum { PROF_NONE, PROF_TEXT, PROF_JSON };
+
+/* output products, all made from the same 8-bit image */
+enum { OUT_JP2, OUT_PNG, OUT_JPG, OUT_PGM, OUT_Y4M };
+
+typedef struct {
+    int type;
+    char *cm;
+    /* instead of --out-dir */
+    char *dir;
+    /* appended to, for y4m */
+    char *file;
+    int quality;
+    int strategy;
+
+    /* resolved once, shared by all files */
+    swap_palette_t *pal;
+    swap_j2kparams_t j2kp;
+    /* hash of everything the content of this output depends on */
+    char *key;
+} output_t;
+
+typedef struct {
+    int noverify, crispen;
+    int datedir, keep_filename, print_filename;
+    char *contact, *outdir, *func;
+    char *dateobs, *telescop, *instrume, *detector, *wavelnth;
+
+    /* inputs after a successful conversion */
+    char *donedir;
+    int delete_input;
+
+    double clipmin, clipmax;
+    /* clip levels at these percentiles of each image, within clipmin, clipmax */
+    double pclip[2];
+    int percentile;
+    double gamma, log_exponent;
+
+    output_t *out;
+    int nout, ny4m;
+
+    int profile;
+    /* skip inputs whose outputs are up to date */
+    int cache;
+    /* only the XML of each input, from its headers */
+    int metaonly;
+    /* x, y, w, h of the region read, every decimate-th pixel; w 0 for all */
+    size_t crop[4];
+    int decimate;
+} conv_t;
+
+typedef struct {
+    char *file;
+    char *error;
+    /* string table/history of this file */
+    p2sc_ctx_t *ctx;
+
+    /* handed from stage to stage */
+    procfits_t *p;
+    guint8 *g;
+    size_t w, h;
+    /* per output */
+    char **name;
+    guint8 **out;
+    size_t *outlen;
+    /* reserved from the memory budget */
+    size_t bytes;
+    /* stage timings, with --profile */
+    p2sc_prof_t *prof;
+    /* DATASUM/CHECKSUM and stamp of the input, with --skip-unchanged */
+    char *sum;
+    int cached;
+} job_t;
+
+/* TYPE[:key=value,...], keys: cm, dir, file, quality, strategy */
+static void output_parse(output_t *o, const char *spec) {
+    static const char *types[] = { "jp2", "png", "jpg", "pgm", "y4m", NULL };
+    char **kv = g_strsplit(spec, ":", 2);
+
+    o->type = -1;
+    for (int i = 0; types[i]; ++i)
+        if (!strcmp(kv[0], types[i]))
+            o->type = i;
+    if (o->type < 0)
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "%s: unknown output type", spec);
+
+    char **opts = kv[1] ? g_strsplit(kv[1], ",", 0) : g_new0(char *, 1);
+    for (char **opt = opts; *opt; ++opt) {
+        char *val = strchr(*opt, '=');
+        if (!val)
+            P2SC_Msg(LVL_FATAL_ARGUMENTS, "%s: expected key=value, got %s", spec, *opt);
+        *val++ = 0;
+
+        if (!strcmp(*opt, "cm")) {
+            g_free(o->cm);
+            o->cm = g_strdup(val);
+        } else if (!strcmp(*opt, "dir")) {
+            g_free(o->dir);
+            o->dir = g_strdup(val);
+        } else if (!strcmp(*opt, "file")) {
+            g_free(o->file);
+            o->file = g_strdup(val);
+        } else if (!strcmp(*opt, "quality"))
+            o->quality = atoi(val);
+        else if (!strcmp(*opt, "strategy"))
+            o->strategy = atoi(val);
+        else
+            P2SC_Msg(LVL_FATAL_ARGUMENTS, "%s: unknown key %s", spec, *opt);
+    }
+    g_strfreev(opts);
+    g_strfreev(kv);
+
+    if (o->type == OUT_Y4M && !o->file)
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "%s: y4m output needs file=name", spec);
+}
+
+static void output_resolve(output_t *o, const swap_j2kparams_t *j2kp) {
+    o->pal = swap_palette_rgb_get(o->cm);
+    o->j2kp = *j2kp;
+    o->j2kp.meta.pal = o->cm ? o->pal : swap_palette_rgb_get("aia171");
+}
+
+static void output_key(output_t *o, const conv_t *c) {
+    const swap_j2kparams_t *p = &o->j2kp;
+    char *opts = g_strdup_printf("%s|%s|%g|%g|%s|%g|%g|%d|%s|%s|%s|%s|%s|"
+                                 "%d|%s|%d|%d|%g|%d|%d|%d|%d|%zu,%zu,%zu,%zu/%d|%d:%g,%g",
+                                 _versionid_, c->contact, c->clipmin, c->clipmax,
+                                 c->func ? c->func : "gamma", c->gamma, c->log_exponent, c->crispen,
+                                 c->dateobs ? c->dateobs : "", c->telescop ? c->telescop : "",
+                                 c->instrume ? c->instrume : "", c->detector ? c->detector : "",
+                                 c->wavelnth ? c->wavelnth : "",
+                                 o->type, o->cm ? o->cm : "", o->quality, o->strategy,
+                                 p->cratio, p->nlayers, p->nresolutions,
+                                 p->precinct[0], p->precinct[1],
+                                 c->crop[0], c->crop[1], c->crop[2], c->crop[3], c->decimate,
+                                 c->percentile, c->pclip[0], c->pclip[1]);
+
+    o->key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, opts, -1);
+    g_free(opts);
+}
+
+static void output_free(output_t *o) {
+    g_free(o->key);
+    g_free(o->cm);
+    g_free(o->dir);
+    g_free(o->file);
+}
+
+static size_t job_bytes(const conv_t *c, size_t w, size_t h, int native) {
+    /* float or 16-bit image, 8-bit image */
+    size_t per_pix = (native ? sizeof(gint16) : sizeof(float)) + 1;
+
+    if (c->crispen)
+        per_pix += 3 * sizeof(float);
+    /* OpenJPEG component or encoded output */
+    for (int i = 0; i < c->nout; ++i)
+        per_pix += c->out[i].type == OUT_JP2 ? sizeof(gint32) : 1;
+    return w * h * per_pix;
+}
+
+static char *output_name(const job_t *, const conv_t *, const output_t *);
+
+/* size, mtime and inode: any rewrite of a file changes it */
+static char *file_stamp(const struct stat *st) {
+    return g_strdup_printf("%lld:%lld.%09ld:%llu", (long long) st->st_size,
+                           (long long) st->st_mtim.tv_sec, (long) st->st_mtim.tv_nsec,
+                           (unsigned long long) st->st_ino);
+}
+
+/* the header cards are only checked when the data is read, the stamp tells an edit */
+static char *job_sum(const job_t *j) {
+    const procfits_t *p = j->p;
+    struct stat st;
+
+    if (!p->datasum || !p->checksum || stat(j->file, &st))
+        return NULL;
+
+    char *stamp = file_stamp(&st);
+    char *sum = g_strdup_printf("%s/%s/%s", p->datasum, p->checksum, stamp);
+    g_free(stamp);
+    return sum;
+}
+
+/* all outputs exist and were made from the same file with the same options */
+static int job_cached(job_t *j, const conv_t *c) {
+    int i, hit = 1;
+
+    /* appended to, never up to date */
+    if (c->ny4m || !(j->sum = job_sum(j)))
+        return 0;
+
+    for (i = 0; i < c->nout && hit; ++i) {
+        char *key = g_strdup_printf("%s/%s", j->sum, c->out[i].key);
+
+        j->name[i] = output_name(j, c, c->out + i);
+        char *val = p2sc_get_xattr(j->name[i], CACHE_XATTR);
+        hit = val && !strcmp(val, key);
+
+        g_free(val);
+        g_free(key);
+    }
+
+    if (!hit)
+        for (i = 0; i < c->nout; ++i) {
+            g_free(j->name[i]);
+            j->name[i] = NULL;
+        }
+    return j->cached = hit;
+}
+
+static void job_read(job_t *j, const conv_t *c, p2sc_sched_t *s) {
+    if (access(j->file, R_OK))
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "cannot read: %s", g_strerror(errno));
+
+    if (c->metaonly) {
+        j->p = fitsproc_metadata(j->file, c->contact, c->dateobs, c->telescop, c->instrume,
+                                 c->detector, c->wavelnth);
+        return;
+    }
+
+    procfits_t *p = fitsproc_header(j->file, c->contact, c->noverify,
+                                    c->dateobs, c->telescop, c->instrume, c->detector,
+                                    c->wavelnth);
+    j->p = p;
+
+    /* before the image data is read */
+    if (c->cache && job_cached(j, c)) {
+        procfits_free(p);
+        j->p = NULL;
+        return;
+    }
+
+    if (c->crop[2] || c->decimate > 1)
+        fitsproc_set_region(p, c->contact, c->crop[0], c->crop[1],
+                            c->crop[2] ? c->crop[2] : p->w, c->crop[2] ? c->crop[3] : p->h,
+                            MAX(c->decimate, 1));
+
+    /* 16-bit counts go straight through a LUT, unless crispened */
+    int native = p->type == SINT16 && !c->crispen;
+
+    size_t bytes = job_bytes(c, p->w, p->h, native);
+    if (s)
+        p2sc_sched_reserve(s, bytes);
+    j->bytes = bytes;
+    if (native)
+        fitsproc_image_raw(p);
+    else
+        fitsproc_image(p);
+
+    /* changed while read: no key, the next run converts it again */
+    if (j->sum) {
+        char *sum = job_sum(j);
+        if (!sum || strcmp(sum, j->sum)) {
+            g_free(j->sum);
+            j->sum = NULL;
+        }
+        g_free(sum);
+    }
+
+    j->p = p;
+}
+
+static void job_process(job_t *j, const conv_t *c, p2sc_sched_t *s G_GNUC_UNUSED) {
+    procfits_t *p = j->p;
+    size_t npix = p->w * p->h;
+    p2sc_mark_t m;
+    guint8 *g;
+
+    if (c->metaonly)
+        return;
+
+    float lo = c->clipmin, hi = c->clipmax;
+    if (c->percentile) {
+        const gint16 *cnt = p->view ? p->view : p->raw;
+
+        p2sc_prof_start(&m);
+        if (cnt) {
+            /* the counts are binned exactly, an automatic bound does not clamp */
+            float wlo = lo == AUTO_CLIP ? -G_MAXFLOAT : lo, whi = hi == AUTO_CLIP ? G_MAXFLOAT : hi;
+            swap_percentile16(cnt, npix, p->view != NULL, p->bscale, p->bzero, wlo, whi,
+                              c->pclip[0] / 100, c->pclip[1] / 100, &lo, &hi);
+        } else {
+            /* the histogram window: an automatic bound is the range of the image */
+            float mn, mx;
+            if ((lo == AUTO_CLIP || hi == AUTO_CLIP) && swap_minmax(p->im, npix, &mn, &mx)) {
+                lo = lo == AUTO_CLIP ? mn : lo;
+                hi = hi == AUTO_CLIP ? mx : hi;
+            }
+            if (lo < hi)
+                swap_percentile(p->im, npix, lo, hi, c->pclip[0] / 100, c->pclip[1] / 100, &lo, &hi);
+        }
+        p2sc_prof_stop(&m, "percentile", npix * (cnt ? sizeof(gint16) : sizeof(float)), 0);
+    }
+
+    if (p->view) {
+        p2sc_prof_start(&m);
+        if (c->func && !strcmp(c->func, "log"))
+            g = swap_xfer_log16be(p->view, p->w, p->h, p->bscale, p->bzero,
+                                  lo, hi, c->log_exponent);
+        else
+            g = swap_xfer_gamma16be(p->view, p->w, p->h, p->bscale, p->bzero,
+                                    lo, hi, c->gamma);
+        p2sc_prof_stop(&m, "transfer", npix * sizeof(gint16), npix);
+        p2sc_ctx_guard(j->ctx, g_free, g);
+
+        j->g = g, j->w = p->w, j->h = p->h;
+        return;
+    }
+
+    if (p->raw) {
+        p2sc_prof_start(&m);
+        if (c->func && !strcmp(c->func, "log"))
+            g = swap_xfer_log16(p->raw, p->w, p->h, p->bscale, p->bzero,
+                                lo, hi, c->log_exponent);
+        else
+            g = swap_xfer_gamma16(p->raw, p->w, p->h, p->bscale, p->bzero,
+                                  lo, hi, c->gamma);
+        p2sc_prof_stop(&m, "transfer", npix * sizeof(gint16), npix);
+        p2sc_ctx_guard(j->ctx, g_free, g);
+
+        g_free(p->raw);
+        p->raw = NULL;
+
+        j->g = g, j->w = p->w, j->h = p->h;
+        return;
+    }
+
+    /* the float image is only rewritten for the crispening */
+    if (c->crispen) {
+        p2sc_prof_start(&m);
+        swap_clamp(p->im, p->w, p->h, lo, hi);
+        p2sc_prof_stop(&m, "clamp", npix * sizeof(float), npix * sizeof(float));
+
+        p2sc_prof_start(&m);
+        swap_crispen(p->im, p->w, p->h);
+        p2sc_prof_stop(&m, "crispen", npix * sizeof(float), npix * sizeof(float));
+    }
+
+    p2sc_prof_start(&m);
+    if (c->func && !strcmp(c->func, "log"))
+        g = swap_clamp_log(p->im, p->w, p->h, lo, hi, c->log_exponent);
+    else
+        g = swap_clamp_gamma(p->im, p->w, p->h, lo, hi, c->gamma);
+    p2sc_prof_stop(&m, "transfer", npix * sizeof(float), npix);
+    p2sc_ctx_guard(j->ctx, g_free, g);
+
+    g_free(p->im);
+    p->im = NULL;
+
+    j->g = g, j->w = p->w, j->h = p->h;
+}
+
+/* Helioviewer names for JP2, or after the input */
+static char *product_name(const job_t *j, const conv_t *c, const output_t *o, const char *ext) {
+    const procfits_t *p = j->p;
+    const char *dir = o->dir ? o->dir : c->outdir;
+
+    char *outdir = c->datedir ? p2sc_name_dirtree(dir, p->dateobs) : g_strdup(dir);
+    char *name;
+
+    if (o->type == OUT_JP2 && !c->keep_filename) {
+        char *jhvname = p2sc_name_swap_jhv(p->dateobs, p->telescop, p->instrume,
+                                           p->detector, p->wavelnth);
+        name = p2sc_name_swap_qlk(outdir, jhvname, ext);
+        g_free(jhvname);
+    } else
+        name = p2sc_name_swap_qlk(outdir, p->name, ext);
+    g_free(outdir);
+
+    return name;
+}
+
+static char *output_name(const job_t *j, const conv_t *c, const output_t *o) {
+    static const char *ext[] = { "jp2", "png", "jpg", "pgm" };
+    return product_name(j, c, o, ext[o->type]);
+}
+
+static void encode_one(job_t *j, const output_t *o, int i) {
+    static const char *stage[] = { "encode.jp2", "encode.png", "encode.jpg", "encode.pgm" };
+    const procfits_t *p = j->p;
+    guint8 *out = NULL;
+    size_t len = 0;
+    p2sc_mark_t m;
+
+    p2sc_prof_start(&m);
+    switch (o->type) {
+    case OUT_JP2:{
+            swap_j2kparams_t j2kp = o->j2kp;
+            j2kp.meta.xml = p->xml;
+            out = swap_encode_j2k(j->name[i], j->g, j->w, j->h, &j2kp, &len);
+            break;
+        }
+    case OUT_PNG:
+        out = swap_encode_png(j->g, j->w, j->h, o->pal, p->xml, o->strategy, &len);
+        break;
+    case OUT_JPG:
+        out = swap_encode_jpg(j->g, j->w, j->h, o->pal, o->quality, p->xml, &len);
+        break;
+    case OUT_PGM:
+        out = swap_encode_pgm((const guint16 *) j->g, j->w, j->h, 255, &len);
+        break;
+    }
+    p2sc_prof_stop(&m, stage[o->type], j->w * j->h, len);
+    p2sc_ctx_guard(j->ctx, g_free, out);
+
+    j->out[i] = out, j->outlen[i] = len;
+}
+
+typedef struct {
+    job_t *j;
+    const output_t *o;
+    int i;
+    gboolean failed;
+} encoder_t;
+
+static gpointer encoder(gpointer data) {
+    encoder_t *e = (encoder_t *) data;
+    jmp_buf jb;
+
+    p2sc_ctx_bind(e->j->ctx);
+    p2sc_catch(&jb);
+    if (setjmp(jb))
+        e->failed = TRUE;
+    else {
+        encode_one(e->j, e->o, e->i);
+        p2sc_catch(NULL);
+    }
+    p2sc_ctx_bind(NULL);
+
+    return NULL;
+}
+
+/* the XML alone, named as the first output */
+static void job_metadata(job_t *j, const conv_t *c) {
+    const procfits_t *p = j->p;
+
+    j->name[0] = product_name(j, c, c->out, "xml");
+    j->out[0] = (guint8 *) g_strdup(p->xml ? p->xml : "");
+    j->outlen[0] = strlen((const char *) j->out[0]);
+    p2sc_ctx_guard(j->ctx, g_free, j->out[0]);
+
+    procfits_free(j->p);
+    j->p = NULL;
+}
+
+/* the encoders of the different outputs run in parallel */
+static void job_encode(job_t *j, const conv_t *c, p2sc_sched_t *s) {
+    int i, n = 0;
+
+    if (c->metaonly) {
+        job_metadata(j, c);
+        return;
+    }
+    encoder_t *e = g_new0(encoder_t, c->nout);
+    GThread **thr = g_new0(GThread *, c->nout);
+
+    for (i = 0; i < c->nout; ++i) {
+        if (c->out[i].type == OUT_Y4M)
+            continue;
+        j->name[i] = output_name(j, c, c->out + i);
+        e[n++] = (encoder_t) {.j = j,.o = c->out + i,.i = i };
+    }
+
+    gboolean failed = FALSE;
+    if (n == 1)
+        encode_one(j, e[0].o, e[0].i);
+    else if (n > 1) {
+        for (i = 0; i < n; ++i)
+            thr[i] = g_thread_new("encoder", encoder, e + i);
+        for (i = 0; i < n; ++i) {
+            g_thread_join(thr[i]);
+            failed |= e[i].failed;
+        }
+    }
+    g_free(thr);
+    g_free(e);
+    /* already reported by the encoder */
+    if (failed)
+        p2sc_fatal();
+
+    procfits_free(j->p);
+    j->p = NULL;
+
+    /* YUV frames are appended in order by job_done() */
+    if (!c->ny4m) {
+        p2sc_ctx_unguard(j->ctx, j->g);
+        g_free(j->g);
+        j->g = NULL;
+
+        if (s)
+            p2sc_sched_release(s, j->bytes);
+        j->bytes = 0;
+    }
+}
+
+static void job_write(job_t *j, const conv_t *c, p2sc_sched_t *s G_GNUC_UNUSED) {
+    for (int i = 0; i < c->nout; ++i) {
+        if (!j->out[i])
+            continue;
+
+        p2sc_mark_t m;
+
+        /* truncation keeps the attributes, a partial write must not look up to date */
+        if (j->sum)
+            p2sc_set_xattr(j->name[i], CACHE_XATTR, NULL);
+
+        p2sc_prof_start(&m);
+        swap_write_file(j->name[i], j->out[i], j->outlen[i]);
+        p2sc_prof_stop(&m, "write", j->outlen[i], j->outlen[i]);
+
+        if (j->sum) {
+            static gint warned = 0;
+            char *key = g_strdup_printf("%s/%s", j->sum, c->out[i].key);
+
+            if (p2sc_set_xattr(j->name[i], CACHE_XATTR, key) &&
+                g_atomic_int_compare_and_exchange(&warned, 0, 1))
+                P2SC_Msg(LVL_WARNING_FILESYSTEM, "%s: cannot record the cache key: %s",
+                         j->name[i], g_strerror(errno));
+            g_free(key);
+        }
+
+        p2sc_ctx_unguard(j->ctx, j->out[i]);
+        g_free(j->out[i]);
+        j->out[i] = NULL;
+    }
+}
+
+typedef void (*job_func_t)(job_t *, const conv_t *, p2sc_sched_t *);
+
+static job_t *job_new(const conv_t *c, const char *file) {
+    job_t *j = (job_t *) g_malloc0(sizeof *j);
+
+    j->file = g_strdup(file);
+    j->name = g_new0(char *, c->nout + 1);
+    j->out = g_new0(guint8 *, c->nout);
+    j->outlen = g_new0(size_t, c->nout);
+    if (c->profile)
+        j->prof = p2sc_prof_new();
+
+    return j;
+}
+
+static void job_free(job_t *j) {
+    p2sc_ctx_free(j->ctx);
+    p2sc_prof_free(j->prof);
+    g_free(j->sum);
+    g_free(j->error);
+    g_strfreev(j->name);
+    g_free(j->out);
+    g_free(j->outlen);
+    g_free(j->file);
+    g_free(j);
+}
+
+/* in order, a fatal error fails this file only */
+static void job_stage(job_t *j, const conv_t *c, p2sc_sched_t *s, job_func_t func) {
+    if (j->error || j->cached)
+        return;
+
+    if (!j->ctx) {
+        char *base = g_path_get_basename(j->file);
+        j->ctx = p2sc_ctx_new(base);
+        p2sc_ctx_set_prof(j->ctx, j->prof);
+        g_free(base);
+    }
+
+    p2sc_ctx_t *old = p2sc_ctx_bind(j->ctx);
+    jmp_buf jb;
+
+    p2sc_catch(&jb);
+    if (setjmp(jb)) {
+        /* whatever the job holds is guarded */
+        p2sc_ctx_cleanup(j->ctx);
+        j->p = NULL, j->g = NULL;
+        for (int i = 0; i < c->nout; ++i) {
+            g_free(j->name[i]);
+            j->name[i] = NULL, j->out[i] = NULL;
+        }
+
+        j->error = p2sc_ctx_dup_string(j->ctx, "error");
+        if (!j->error)
+            j->error = g_strdup("fatal error");
+
+        if (s && j->bytes)
+            p2sc_sched_release(s, j->bytes);
+        j->bytes = 0;
+    } else {
+        func(j, c, s);
+        p2sc_catch(NULL);
+    }
+
+    p2sc_ctx_bind(old);
+}
+
+static void job_done(job_t *j, const conv_t *c, p2sc_sched_t *s) {
+    p2sc_ctx_t *old = p2sc_ctx_bind(j->ctx);
+
+    if (j->g) {
+        for (int i = 0; i < c->nout; ++i)
+            if (c->out[i].type == OUT_Y4M)
+                swap_y4m(c->out[i].file, c->out[i].cm, j->g, j->w, j->h);
+
+        p2sc_ctx_unguard(j->ctx, j->g);
+        g_free(j->g);
+        j->g = NULL;
+        if (s)
+            p2sc_sched_release(s, j->bytes);
+        j->bytes = 0;
+    }
+
+    if (c->print_filename)
+        for (int i = 0; i < c->nout; ++i)
+            if (j->name[i])
+                printf("%s\n", j->name[i]);
+
+    p2sc_ctx_bind(old);
+}
+
+/* after the OK/FAILED line; JSON goes to stdout, one object per line */
+static void job_report(const job_t *j, const conv_t *c) {
+    if (c->profile == PROF_JSON) {
+        char *json = p2sc_prof_json(j->prof, j->file, j->error);
+        printf("%s\n", json);
+        fflush(stdout);
+        g_free(json);
+    } else if (c->profile == PROF_TEXT) {
+        char *text = p2sc_prof_text(j->prof);
+        fprintf(stderr, "profile %s:\n%s", j->file, text);
+        g_free(text);
+    }
+}
+
+static int is_fits(const char *name) {
+    static const char *ext[] = { ".fits", ".fts", ".fit", ".fits.gz", ".fts.gz", NULL };
+
+    for (const char **e = ext; *e; ++e)
+        if (g_str_has_suffix(name, *e))
+            return 1;
+    return 0;
+}
+
+static int compare_names(gconstpointer a, gconstpointer b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* expand positional arguments: directories are scanned, - reads names from stdin */
+static char **batch_inputs(int argc, char **argv) {
+    GArray *a = g_array_new(TRUE, FALSE, sizeof(char *));
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-")) {
+            char *line;
+            p2sc_iofile_t *io = p2sc_open_iofile("-", "r");
+
+            while ((line = p2sc_read_line(io))) {
+                g_strstrip(line);
+                if (*line)
+                    g_array_append_val(a, line);
+                else
+                    g_free(line);
+            }
+            p2sc_free_iofile(io);
+        } else if (g_file_test(argv[i], G_FILE_TEST_IS_DIR)) {
+            char **files = p2sc_dirscan(argv[i]);
+            guint j, n = g_strv_length(files), first = a->len;
+
+            for (j = 0; j < n; ++j) {
+                if (is_fits(files[j]))
+                    g_array_append_val(a, files[j]);
+                else
+                    g_free(files[j]);
+            }
+            g_free(files);
+            /* nftw order is the directory order, make it reproducible */
+            if (a->len > first)
+                qsort(&g_array_index(a, char *, first), a->len - first, sizeof(char *),
+                      compare_names);
+        } else {
+            char *name = g_strdup(argv[i]);
+            g_array_append_val(a, name);
+        }
+    }
+
+    return (char **) g_array_free(a, FALSE);
+}
+
+typedef struct {
+    const conv_t *c;
+    p2sc_sched_t *s;
+    guint nok, ncached, nfail;
+} batch_t;
+
+static void batch_read(void *job, void *data) {
+    batch_t *b = (batch_t *) data;
+    job_stage((job_t *) job, b->c, b->s, job_read);
+}
+
+static void batch_process(void *job, void *data) {
+    batch_t *b = (batch_t *) data;
+    job_stage((job_t *) job, b->c, b->s, job_process);
+}
+
+static void batch_encode(void *job, void *data) {
+    batch_t *b = (batch_t *) data;
+    job_stage((job_t *) job, b->c, b->s, job_encode);
+}
+
+static void batch_write(void *job, void *data) {
+    batch_t *b = (batch_t *) data;
+    job_stage((job_t *) job, b->c, b->s, job_write);
+}
+
+static void input_done(const conv_t *c, const char *file) {
+    if (c->donedir) {
+        char *base = g_path_get_basename(file);
+        char *dest = g_build_filename(c->donedir, base, NULL);
+
+        if (rename(file, dest))
+            P2SC_Msg(LVL_WARNING_FILESYSTEM, "%s -> %s: %s", file, dest, g_strerror(errno));
+        g_free(dest);
+        g_free(base);
+    } else if (c->delete_input) {
+        if (unlink(file))
+            P2SC_Msg(LVL_WARNING_FILESYSTEM, "%s: %s", file, g_strerror(errno));
+    }
+}
+
+static void batch_done(void *job, void *data) {
+    job_t *j = (job_t *) job;
+    batch_t *b = (batch_t *) data;
+
+    job_done(j, b->c, b->s);
+
+    if (j->error) {
+        fprintf(stderr, "FAILED %s: %s\n", j->file, j->error);
+        ++b->nfail;
+    } else {
+        GString *out = g_string_new(NULL);
+        for (int i = 0; i < b->c->nout; ++i) {
+            const char *name = j->name[i] ? j->name[i] : b->c->out[i].file;
+            if (name)
+                g_string_append_printf(out, "%s%s", out->len ? " " : "", name);
+        }
+        fprintf(stderr, "%s %s -> %s\n", j->cached ? "UNCHANGED" : "OK", j->file, out->str);
+        g_string_free(out, TRUE);
+        input_done(b->c, j->file);
+        if (j->cached)
+            ++b->ncached;
+        else
+            ++b->nok;
+    }
+    job_report(j, b->c);
+
+    job_free(j);
+}
+
+/* I/O of one file overlaps the processing and encoding of the others */
+static void batch_start(batch_t *b, int njobs, int iojobs, gint64 maxbytes) {
+    const p2sc_sched_stage_t stages[] = {
+        { "read", iojobs, batch_read },
+        { "process", njobs, batch_process },
+        { "encode", njobs, batch_encode },
+        { "write", iojobs, batch_write }
+    };
+
+    b->s = p2sc_sched_new_stages(G_N_ELEMENTS(stages), stages,
+                                 maxbytes > 0 ? (size_t) maxbytes : 0, batch_done, b);
+}
+
+static void batch_push(batch_t *b, const char *file) {
+    p2sc_sched_push(b->s, job_new(b->c, file));
+}
+
+static int batch(const conv_t *c, char **files, int njobs, int iojobs, gint64 maxbytes) {
+    batch_t b = {.c = c };
+    guint i, n = g_strv_length(files);
+
+    batch_start(&b, njobs, iojobs, maxbytes);
+    for (i = 0; i < n; ++i)
+        batch_push(&b, files[i]);
+    p2sc_sched_free(b.s);
+
+    fprintf(stderr, "%u file(s): %u converted, %u unchanged, %u failed\n", n, b.nok, b.ncached,
+            b.nfail);
+
+    return b.nfail ? 1 : 0;
+}
+
+static int profile_mode = PROF_NONE;
+
+static gboolean profile_option(const gchar *name G_GNUC_UNUSED, const gchar *value,
+                               gpointer data G_GNUC_UNUSED, GError **error G_GNUC_UNUSED) {
+    if (!value || !strcmp(value, "text"))
+        profile_mode = PROF_TEXT;
+    else if (!strcmp(value, "json"))
+        profile_mode = PROF_JSON;
+    else
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "--profile=%s: expected text or json", value);
+    return TRUE;
+}
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static void watch_signal(int sig G_GNUC_UNUSED) {
+    watch_stop = 1;
+}
+
+/* a scanned file modified this recently may still be open for writing */
+#define WATCH_SETTLE 2
+
+typedef struct {
+    batch_t *b;
+    const char *dir;
+    /* name -> the size, mtime and inode it was queued with */
+    GHashTable *queued;
+    guint pruned;
+    /* scanned but maybe still being written */
+    GHashTable *settling;
+} watcher_t;
+
+/* drop the names of files gone, converted with --delete-input/--done-dir */
+static void watch_prune(watcher_t *w) {
+    GHashTableIter it;
+    gpointer name;
+
+    if (g_hash_table_size(w->queued) < 2 * w->pruned + 1024)
+        return;
+
+    g_hash_table_iter_init(&it, w->queued);
+    while (g_hash_table_iter_next(&it, &name, NULL))
+        if (!g_file_test((const char *) name, G_FILE_TEST_EXISTS))
+            g_hash_table_iter_remove(&it);
+    w->pruned = g_hash_table_size(w->queued);
+}
+
+/*
+   queue a file once per state: the events of a file the scan queued, or a
+   second event of the same file, are dropped
+ */
+static void watch_queue(watcher_t *w, const char *file, int scanned) {
+    struct stat st;
+
+    if (stat(file, &st) || !S_ISREG(st.st_mode)) {
+        g_hash_table_remove(w->settling, file);
+        return;
+    }
+    /* its close event, or the next check, queues it */
+    if (scanned && time(NULL) - st.st_mtime < WATCH_SETTLE) {
+        g_hash_table_add(w->settling, g_strdup(file));
+        return;
+    }
+    g_hash_table_remove(w->settling, file);
+
+    char *stamp = file_stamp(&st);
+    const char *old = (const char *) g_hash_table_lookup(w->queued, file);
+
+    if (old && !strcmp(old, stamp)) {
+        g_free(stamp);
+        return;
+    }
+    g_hash_table_replace(w->queued, g_strdup(file), stamp);
+    batch_push(w->b, file);
+    watch_prune(w);
+}
+
+/* what is in the directory, not recursing */
+static void watch_scan(watcher_t *w) {
+    GPtrArray *a = g_ptr_array_new_with_free_func(g_free);
+    GDir *d = g_dir_open(w->dir, 0, NULL);
+    const char *entry;
+
+    while (d && (entry = g_dir_read_name(d)))
+        if (is_fits(entry))
+            g_ptr_array_add(a, g_build_filename(w->dir, entry, NULL));
+    if (d)
+        g_dir_close(d);
+
+    g_ptr_array_sort(a, compare_names);
+    for (guint i = 0; i < a->len && !watch_stop; ++i)
+        watch_queue(w, (const char *) g_ptr_array_index(a, i), 1);
+    g_ptr_array_free(a, TRUE);
+}
+
+/* scanned files left alone for WATCH_SETTLE seconds without an event */
+static void watch_settle(watcher_t *w) {
+    GPtrArray *a = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter it;
+    gpointer name;
+
+    g_hash_table_iter_init(&it, w->settling);
+    while (g_hash_table_iter_next(&it, &name, NULL))
+        g_ptr_array_add(a, g_strdup((const char *) name));
+
+    g_ptr_array_sort(a, compare_names);
+    for (guint i = 0; i < a->len; ++i)
+        watch_queue(w, (const char *) g_ptr_array_index(a, i), 1);
+    g_ptr_array_free(a, TRUE);
+}
+
+/* daemon: convert the files landing in dir until SIGINT/SIGTERM */
+static int watch(const conv_t *c, const char *dir, int njobs, int iojobs, gint64 maxbytes) {
+    batch_t b = {.c = c };
+
+    signal(SIGINT, watch_signal);
+    signal(SIGTERM, watch_signal);
+
+    batch_start(&b, njobs, iojobs, maxbytes);
+
+    watcher_t w = {
+        .b = &b,.dir = dir,
+        .queued = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free),
+        .settling = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL)
+    };
+
+    /* watch first, then pick up what is already there */
+    p2sc_watch_t *pw = p2sc_watch_new(dir);
+    watch_scan(&w);
+
+    while (!watch_stop) {
+        char *file = p2sc_watch_next(pw, 1000);
+
+        if (file && is_fits(file))
+            watch_queue(&w, file, 0);
+        g_free(file);
+
+        if (p2sc_watch_overflow(pw))
+            watch_scan(&w);
+        if (g_hash_table_size(w.settling))
+            watch_settle(&w);
+    }
+
+    p2sc_watch_free(pw);
+    p2sc_sched_free(b.s);
+    g_hash_table_destroy(w.settling);
+    g_hash_table_destroy(w.queued);
+
+    fprintf(stderr, "%s: %u converted, %u unchanged, %u failed\n", dir, b.nok, b.ncached, b.nfail);
+
+    return b.nfail ? 1 : 0;
+}
 
 int main(int argc, char **argv) {
-    int datedir = 0, noverify = 0, jpeg = 0, jhv = 0, crispen = 0, debug = 0, pgm = 0;
-    int keep_filename = 0, print_filename = 0;
-    char *appname = NULL, *contact = NULL, *outdir = NULL;
-    char *yuv = NULL, *cm = NULL, *func = NULL;
-    char *dateobs = NULL, *telescop = NULL, *instrume = NULL, *detector = NULL, *wavelnth = NULL;
-
-    double clipmin = DEF_CLIP_MIN, clipmax = DEF_CLIP_MAX;
-    double gamma = DEF_GAMMA, log_exponent = DEF_LOG_EXPONENT;
-    double cratio = DEF_CRATIO;
+    int jbatch = 0, jwatch = 0, debug = 0, njobs = 1, iojobs = DEF_IO_JOBS;
+    gint64 maxbytes = DEF_MAX_INFLIGHT;
+    char *appname = NULL;
+
     int nlayers = DEF_NLAYERS, nresolutions = DEF_NRESOLUTIONS;
     int precinctw = DEF_PRECINCTW, precincth = DEF_PRECINCTH;
-    int strategy = DEF_STRATEGY;
+    double cratio = DEF_CRATIO;
+
+    /* single output, when no --output is given */
+    int jpeg = 0, pgm = 0, jhv = 0, strategy = DEF_STRATEGY;
+    char *yuv = NULL, *cm = NULL, **outputs = NULL, *crop = NULL, *pclip = NULL;
+
+    conv_t c = {
+        .clipmin = DEF_CLIP_MIN,.clipmax = DEF_CLIP_MAX,
+        .gamma = DEF_GAMMA,.log_exponent = DEF_LOG_EXPONENT
+    };
+
+    /* arg_data is a data pointer, the callback goes through a union as ISO C wants */
+    union {
+        GOptionArgFunc func;
+        gpointer data;
+    } profile_cb = {.func = profile_option };
 
     GOptionEntry entries[] = {
         { "appname", 'a', 0, G_OPTION_ARG_STRING, &appname,
          "Present to LMAT other appname than " APP_NAME, APP_NAME },
-        { "contact", 'c', 0, G_OPTION_ARG_STRING, &contact,
+        { "contact", 'c', 0, G_OPTION_ARG_STRING, &c.contact,
          "Contact information", "swhv@oma.be" },
-        { "out-dir", 'o', 0, G_OPTION_ARG_STRING, &outdir,
+        { "out-dir", 'o', 0, G_OPTION_ARG_STRING, &c.outdir,
          "Output directory", "name" },
-        { "out-dateobs-dir", 'O', 0, G_OPTION_ARG_NONE, &datedir,
+        { "out-dateobs-dir", 'O', 0, G_OPTION_ARG_NONE, &c.datedir,
          "Use the date of observation for the output directory name", NULL },
-        { "function", 'f', 0, G_OPTION_ARG_STRING, &func,
+        { "function", 'f', 0, G_OPTION_ARG_STRING, &c.func,
          "Pixel transfer function: gamma, log", "gamma" },
-        { "gamma", 'g', 0, G_OPTION_ARG_DOUBLE, &gamma,
+        { "gamma", 'g', 0, G_OPTION_ARG_DOUBLE, &c.gamma,
          "Gamma correction exponent", G_STRINGIFY(DEF_GAMMA) },
-        { "log", 'l', 0, G_OPTION_ARG_DOUBLE, &log_exponent,
+        { "log", 'l', 0, G_OPTION_ARG_DOUBLE, &c.log_exponent,
          "Log correction exponent", G_STRINGIFY(DEF_LOG_EXPONENT) },
-        { "min-clip", 'm', 0, G_OPTION_ARG_DOUBLE, &clipmin,
+        { "min-clip", 'm', 0, G_OPTION_ARG_DOUBLE, &c.clipmin,
          "Clip lower pixel values", G_STRINGIFY(DEF_CLIP_MIN) },
-        { "max-clip", 'M', 0, G_OPTION_ARG_DOUBLE, &clipmax,
+        { "max-clip", 'M', 0, G_OPTION_ARG_DOUBLE, &c.clipmax,
          "Clip higher pixel values", G_STRINGIFY(DEF_CLIP_MAX) },
-        { "crispen", 0, 0, G_OPTION_ARG_NONE, &crispen,
+        { "clip-percentile", 0, 0, G_OPTION_ARG_STRING, &pclip,
+         "Clip at these percentiles of each image instead, within the min/max clip", "lo,hi" },
+        { "crispen", 0, 0, G_OPTION_ARG_NONE, &c.crispen,
          "Apply a crispening filter", NULL },
         { "jpeg", 'j', 0, G_OPTION_ARG_INT, &jpeg,
          "Output a JPEG file of a certain quality instead of a PNG", "75" },
@@ -75,9 +1051,9 @@ int main(int argc, char **argv) {
          "Output a PGM file instead of a PNG", NULL },
         { "jhv", 'J', 0, G_OPTION_ARG_NONE, &jhv,
          "Output a file suitable for use with Helioviewer", NULL },
-        { "keep-filename", 'k', 0, G_OPTION_ARG_NONE, &keep_filename,
+        { "keep-filename", 'k', 0, G_OPTION_ARG_NONE, &c.keep_filename,
          "Keep original filename (for --jhv)", NULL },
-        { "print-filename", 'p', 0, G_OPTION_ARG_NONE, &print_filename,
+        { "print-filename", 'p', 0, G_OPTION_ARG_NONE, &c.print_filename,
          "Print output filename", NULL },
         { "cratio", 0, 0, G_OPTION_ARG_DOUBLE, &cratio,
          "OpenJPEG compression ratio", G_STRINGIFY(DEF_CRATIO) },
@@ -97,98 +1073,163 @@ int main(int argc, char **argv) {
          "Append YUV420 to a file instead", "name" },
         { "colormap", 'C', 0, G_OPTION_ARG_STRING, &cm,
          "Use a colormap: aia171, eui174, eui304, eui1216, citrus, hot, jet", "name" },
-        { "no-verify", 'N', 0, G_OPTION_ARG_NONE, &noverify,
+        { "output", 0, 0, G_OPTION_ARG_STRING_ARRAY, &outputs,
+         "Output product, repeatable: TYPE[:key=value,...], TYPE is jp2, png, jpg, pgm or y4m, "
+         "keys are cm, dir, file (y4m), quality (jpg), strategy (png)", "spec" },
+        { "crop", 0, 0, G_OPTION_ARG_STRING, &crop,
+         "Read only this region, from the top left of the image", "x,y,w,h" },
+        { "decimate", 0, 0, G_OPTION_ARG_INT, &c.decimate,
+         "Read only every N-th pixel of each N-th row, e.g. 2, 4 or 8 for a preview", "N" },
+        { "no-verify", 'N', 0, G_OPTION_ARG_NONE, &c.noverify,
          "Do not verify FITS checksums", NULL },
-        { "date-obs", 0, 0, G_OPTION_ARG_STRING, &dateobs,
+        { "date-obs", 0, 0, G_OPTION_ARG_STRING, &c.dateobs,
          "DATE-OBS keyword override", NULL },
-        { "telescop", 0, 0, G_OPTION_ARG_STRING, &telescop,
+        { "telescop", 0, 0, G_OPTION_ARG_STRING, &c.telescop,
          "TELESCOP/OBSRVTRY keyword override", NULL },
-        { "instrume", 0, 0, G_OPTION_ARG_STRING, &instrume,
+        { "instrume", 0, 0, G_OPTION_ARG_STRING, &c.instrume,
          "INSTRUME keyword override", NULL },
-        { "detector", 0, 0, G_OPTION_ARG_STRING, &detector,
+        { "detector", 0, 0, G_OPTION_ARG_STRING, &c.detector,
          "DETECTOR keyword override", NULL },
-        { "wavelnth", 0, 0, G_OPTION_ARG_STRING, &wavelnth,
+        { "wavelnth", 0, 0, G_OPTION_ARG_STRING, &c.wavelnth,
          "WAVELNTH keyword override", NULL },
+        { "batch", 'b', 0, G_OPTION_ARG_NONE, &jbatch,
+         "Convert all FILEs (directories are scanned, - reads names from stdin)", NULL },
+        { "watch", 0, 0, G_OPTION_ARG_NONE, &jwatch,
+         "Run as a daemon converting the FITS files landing in the directory FILE", NULL },
+        { "jobs", 0, 0, G_OPTION_ARG_INT, &njobs,
+         "Number of files processed and encoded in parallel (with --batch/--watch)", "1" },
+        { "io-jobs", 0, 0, G_OPTION_ARG_INT, &iojobs,
+         "Number of files read and written in parallel (with --batch/--watch)",
+         G_STRINGIFY(DEF_IO_JOBS) },
+        { "max-inflight-bytes", 0, 0, G_OPTION_ARG_INT64, &maxbytes,
+         "Memory budget for the images in flight (with --batch/--watch)",
+         G_STRINGIFY(DEF_MAX_INFLIGHT) },
+        { "done-dir", 0, 0, G_OPTION_ARG_STRING, &c.donedir,
+         "Move converted inputs to this directory (with --batch/--watch)", "name" },
+        { "delete-input", 0, 0, G_OPTION_ARG_NONE, &c.delete_input,
+         "Delete converted inputs (with --batch/--watch)", NULL },
+        { "skip-unchanged", 0, 0, G_OPTION_ARG_NONE, &c.cache,
+         "Skip inputs whose outputs exist and were made from the same data and options", NULL },
+        { "metadata-only", 0, 0, G_OPTION_ARG_NONE, &c.metaonly,
+         "Write only the XML metadata of each input, reading its headers but no data", NULL },
+        { "profile", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, profile_cb.data,
+         "Report per-stage wall/CPU time, bytes and peak memory of each file", "text|json" },
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
     };
 
-    p2sc_option(argc, argv, APP_NAME, "FILE - SWHV Media Product Generator",
-                "This program generates quicklook images out of FITS files", entries);
+    p2sc_option_ext(1, &argc, &argv, APP_NAME, "FILE... - SWHV Media Product Generator",
+                    "This program generates quicklook images out of FITS files", entries);
     if (appname) {
         p2sc_set_string("appname", appname);
         g_free(appname);
     }
 
-    contact = contact == NULL ? g_strdup("swhv@oma.be") : contact;
-    procfits_t *p = fitsproc(argv[1], contact, noverify, dateobs, telescop, instrume, detector, wavelnth);
-    g_free(contact);
-    g_free(dateobs), g_free(telescop), g_free(instrume), g_free(detector), g_free(wavelnth);
+    c.contact = c.contact == NULL ? g_strdup("swhv@oma.be") : c.contact;
 
-    guint8 *g;
-    swap_clamp(p->im, p->w, p->h, clipmin, clipmax);
+    if (crop) {
+        char end;
+        if (sscanf(crop, "%zu,%zu,%zu,%zu%c", c.crop, c.crop + 1, c.crop + 2, c.crop + 3, &end) != 4 ||
+            !c.crop[2] || !c.crop[3])
+            P2SC_Msg(LVL_FATAL_ARGUMENTS, "--crop=%s: expected x,y,w,h", crop);
+        g_free(crop);
+    }
+    if (pclip) {
+        char end;
+        if (sscanf(pclip, "%lf,%lf%c", c.pclip, c.pclip + 1, &end) != 2 ||
+            !(c.pclip[0] >= 0 && c.pclip[0] < c.pclip[1] && c.pclip[1] <= 100))
+            P2SC_Msg(LVL_FATAL_ARGUMENTS, "--clip-percentile=%s: expected lo,hi in 0-100, lo < hi",
+                     pclip);
+        c.percentile = 1;
+        g_free(pclip);
+    }
+    if (c.decimate < 0)
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "--decimate must be at least 1");
+    c.profile = profile_mode;
 
-    if (crispen)
-        swap_crispen(p->im, p->w, p->h);
+    swap_j2kparams_t j2kp = {
+        .cratio = cratio,
+        .nlayers = nlayers,
+        .nresolutions = nresolutions,
+        .precinct = { precinctw, precincth },
+        .meta = {.xml = NULL,.pal = NULL },
+        .debug = debug
+    };
 
-    if (func && !strcmp(func, "log"))
-        g = swap_xfer_log(p->im, p->w, p->h, clipmin, clipmax, log_exponent);
-    else
-        g = swap_xfer_gamma(p->im, p->w, p->h, clipmin, clipmax, gamma);
-    g_free(func);
+    if (outputs) {
+        c.nout = g_strv_length(outputs);
+        c.out = g_new0(output_t, c.nout);
+        for (int i = 0; i < c.nout; ++i) {
+            c.out[i] = (output_t) {.quality = 75,.strategy = strategy,.cm = g_strdup(cm) };
+            output_parse(c.out + i, outputs[i]);
+        }
+        g_strfreev(outputs);
+    } else {
+        c.nout = 1;
+        c.out = g_new0(output_t, 1);
+        c.out->cm = g_strdup(cm), c.out->strategy = strategy, c.out->quality = jpeg;
 
-    if (datedir) {
-        char *od = outdir;
-        outdir = p2sc_name_dirtree(outdir, p->dateobs);
-        g_free(od);
+        /* the daemon makes Helioviewer JP2 unless another output was asked for */
+        if (yuv) {
+            c.out->type = OUT_Y4M;
+            c.out->file = g_strdup(yuv);
+        } else if (jhv || (jwatch && !pgm && !jpeg))
+            c.out->type = OUT_JP2;
+        else if (pgm)
+            c.out->type = OUT_PGM;
+        else if (jpeg)
+            c.out->type = OUT_JPG;
+        else
+            c.out->type = OUT_PNG;
+    }
+    for (int i = 0; i < c.nout; ++i) {
+        output_resolve(c.out + i, &j2kp);
+        output_key(c.out + i, &c);
+        c.ny4m += c.out[i].type == OUT_Y4M;
+    }
+    if (c.cache && c.ny4m)
+        P2SC_Msg(LVL_WARNING_ARGUMENTS, "--skip-unchanged has no effect with a y4m output");
+    if (c.metaonly && c.cache)
+        P2SC_Msg(LVL_WARNING_ARGUMENTS, "--skip-unchanged has no effect with --metadata-only");
+    /* the inputs were not converted */
+    if (c.metaonly && (c.donedir || c.delete_input)) {
+        P2SC_Msg(LVL_WARNING_ARGUMENTS, "--done-dir/--delete-input ignored with --metadata-only");
+        g_free(c.donedir);
+        c.donedir = NULL, c.delete_input = 0;
     }
 
-    if (yuv) {
-        swap_y4m(yuv, cm, g, p->w, p->h);
-        g_free(yuv);
+    /* the processing threads of --jobs leave the rest of the CPUs to the pixel loops */
+    if (jbatch || jwatch)
+        p2sc_parallel_budget(MAX((int) g_get_num_processors() - MAX(njobs, 1), 0));
+
+    int ret = 0;
+    if (jwatch) {
+        ret = watch(&c, argv[1], njobs, iojobs, maxbytes);
+    } else if (jbatch) {
+        char **files = batch_inputs(argc, argv);
+        ret = batch(&c, files, njobs, iojobs, maxbytes);
+        g_strfreev(files);
     } else {
-        char *name;
-        if (jhv) {
-            if (keep_filename) {
-                name = p2sc_name_swap_qlk(outdir, p->name, "jp2");
-            } else {
-                char *jhvname = p2sc_name_swap_jhv(p->dateobs, p->telescop, p->instrume,
-                                                   p->detector, p->wavelnth);
-                name = p2sc_name_swap_qlk(outdir, jhvname, "jp2");
-                g_free(jhvname);
-            }
+        job_t *j = job_new(&c, argv[1]);
 
-            swap_j2kparams_t j2kp = {
-                .cratio = cratio,
-                .nlayers = nlayers,
-                .nresolutions = nresolutions,
-                .precinct = { precinctw, precincth },
-                .meta = {
-                         .xml = p->xml,
-                         .pal = cm ? swap_palette_rgb_get(cm) : swap_palette_rgb_get("aia171")
-                          },
-                .debug = debug
-            };
-            swap_write_j2k(name, g, p->w, p->h, &j2kp);
-        } else if (pgm) {
-            name = p2sc_name_swap_qlk(outdir, p->name, "pgm");
-            swap_write_pgm(name, (const guint16 *) g, p->w, p->h, 255);
-        } else if (jpeg) {
-            name = p2sc_name_swap_qlk(outdir, p->name, "jpg");
-            swap_write_jpg(name, g, p->w, p->h, swap_palette_rgb_get(cm), jpeg, p->xml);
-        } else {
-            name = p2sc_name_swap_qlk(outdir, p->name, "png");
-            swap_write_png(name, g, p->w, p->h, swap_palette_rgb_get(cm), p->xml, strategy);
-        }
-        if (print_filename)
-            printf("%s\n", name);
-        g_free(name);
-    }
+        /* the failure was already reported */
+        job_stage(j, &c, NULL, job_read);
+        job_stage(j, &c, NULL, job_process);
+        job_stage(j, &c, NULL, job_encode);
+        job_stage(j, &c, NULL, job_write);
+        job_done(j, &c, NULL);
+        ret = j->error ? 1 : 0;
 
-    g_free(g);
-    procfits_free(p);
+        job_report(j, &c);
+        job_free(j);
+    }
 
-    g_free(cm);
-    g_free(outdir);
+    for (int i = 0; i < c.nout; ++i)
+        output_free(c.out + i);
+    g_free(c.out);
+    g_free(yuv), g_free(cm);
+    g_free(c.contact), g_free(c.outdir), g_free(c.func);
+    g_free(c.dateobs), g_free(c.telescop), g_free(c.instrume), g_free(c.detector), g_free(c.wavelnth);
+    g_free(c.donedir);
 
-    return 0;
+    return ret;
 }
@@ -18,6 +18,10 @@ static const char _versionid_[] __attribute__((unused)) =
 #include <string.h>
 #include <glib.h>
 
+#ifdef __linux__
+#include <sys/xattr.h>
+#endif
+
 #include "p2sc_file.h"
 #include "p2sc_msg.h"
 #include "p2sc_stdlib.h"
@@ -94,11 +98,12 @@ struct p2sc_iofile_t {
     GIOChannel *io;
     char *name;
     size_t lineno;
+    p2sc_ctx_t *ctx;
 };
 
 p2sc_iofile_t *p2sc_open_iofile(const char *name, const char *mode) {
     GError *err = NULL;
-    p2sc_iofile_t *f = (p2sc_iofile_t *) g_malloc(sizeof *f);
+    p2sc_iofile_t *f = (p2sc_iofile_t *) g_malloc0(sizeof *f);
 
     if (name[0] == '-') {
         if (mode[0] == 'r') {
@@ -146,12 +151,15 @@ p2sc_iofile_t *p2sc_open_iofile(const char *name, const char *mode) {
 
     g_io_channel_set_close_on_unref(f->io, TRUE);
     f->lineno = 0;
+    f->ctx = p2sc_ctx_current();
+    p2sc_ctx_guard(f->ctx, (void (*)(void *)) p2sc_free_iofile, f);
 
     return f;
 }
 
 void p2sc_free_iofile(p2sc_iofile_t *f) {
     if (f) {
+        p2sc_ctx_unguard(f->ctx, f);
         if (f->io)
             g_io_channel_unref(f->io);
         g_free(f->name);
@@ -400,6 +408,44 @@ static int descend(const char *name, const struct stat *st G_GNUC_UNUSED,
     return 0;
 }
 
+#ifdef __linux__
+
+char *p2sc_get_xattr(const char *file, const char *name) {
+    ssize_t len = getxattr(file, name, NULL, 0);
+    if (len < 0)
+        return NULL;
+
+    char *ret = (char *) g_malloc(len + 1);
+    len = getxattr(file, name, ret, len);
+    if (len < 0) {
+        g_free(ret);
+        return NULL;
+    }
+    ret[len] = 0;
+
+    return ret;
+}
+
+int p2sc_set_xattr(const char *file, const char *name, const char *value) {
+    if (!value)
+        return removexattr(file, name) && errno != ENODATA ? -1 : 0;
+    return setxattr(file, name, value, strlen(value), 0);
+}
+
+#else
+
+char *p2sc_get_xattr(const char *file G_GNUC_UNUSED, const char *name G_GNUC_UNUSED) {
+    return NULL;
+}
+
+int p2sc_set_xattr(const char *file G_GNUC_UNUSED, const char *name G_GNUC_UNUSED,
+                   const char *value G_GNUC_UNUSED) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
+
 char **p2sc_dirscan(const char *name) {
     gboolean segfree = TRUE;
     char **ret = NULL;
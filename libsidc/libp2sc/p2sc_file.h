@@ -50,6 +50,10 @@ extern "C" {
 
     char **p2sc_dirscan(const char *);
 
+    /* extended attribute of a file, NULL if unset; a NULL value removes it */
+    char *p2sc_get_xattr(const char *, const char *);
+    int p2sc_set_xattr(const char *, const char *, const char *);
+
 /* ---------------------------------------------------------------------- */
 
 #ifdef __cplusplus
@@ -8,16 +8,23 @@
 static const char _versionid_[] __attribute__((unused)) =
     "$Id: p2sc_fits.c 5204 2015-04-30 19:12:42Z bogdan $";
 
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <glib.h>
 #include <fitsio.h>
+#include <fitsio2.h>
 
 #include "p2sc_file.h"
 #include "p2sc_fits.h"
+#include "p2sc_gz.h"
 #include "p2sc_msg.h"
+#include "p2sc_parallel.h"
 #include "p2sc_stdlib.h"
+#include "p2sc_sum.h"
 #include "p2sc_time.h"
 
 #define CHK_FTS(f) \
@@ -27,19 +34,64 @@ static const char _versionid_[] __attribute__((unused)) =
     \
             fits_get_errstatus(f->stat, _msg); \
             _msg[30] = 0; \
-            P2SC_Msg(LVL_FATAL_FITS, "FITS: %s: %s", _msg, _base); \
+            P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: %s: %s", _msg, _base); \
             g_free(_base); \
         } \
     } while (0)
 
+/* one header card, the value field as written, quotes included */
+typedef struct {
+    char *key;
+    char *val;
+    char *com;
+} card_t;
+
+/* header of one HDU of a read-only file, parsed once */
+typedef struct {
+    int hdu;
+    GArray *cards;
+    /* keyword -> first card, from 1 */
+    GHashTable *keys;
+    /* some card did not parse, cfitsio lists the header */
+    int bad;
+} hindex_t;
+
 struct sfts_t {
     fitsfile *fts;
     void *ptr;
     char *name;
     size_t size;
     int stat;
+    /* job context the file belongs to */
+    p2sc_ctx_t *ctx;
+    /* checksums left to sfts_read_image() */
+    int verify;
+    /* HDU whose DATASUM was written from memory */
+    int sumhdu;
+    /* keyword index of the current HDU */
+    hindex_t *hdr;
+    /* map behind sfts_map_image() */
+    GBytes *view;
+    /* the file in memory: inflated gzip, or only the headers (sfts_openhdr()) */
+    void *mem;
+    size_t memsize;
+    /* FITS sums of the 2880-byte blocks of the inflated gzip, taken on the way */
+    guint32 *sums;
+    int headonly;
 };
 
+static void hdr_free(hindex_t *x) {
+    if (x) {
+        for (guint i = 0; i < x->cards->len; ++i) {
+            card_t *c = &g_array_index(x->cards, card_t, i);
+            g_free(c->key), g_free(c->val), g_free(c->com);
+        }
+        g_array_free(x->cards, TRUE);
+        g_hash_table_destroy(x->keys);
+        g_free(x);
+    }
+}
+
 static int compare_fits(sfts_t *f) {
     sfts_t *of = sfts_openro(f->name);
     sfkey_t k = { "DATASUM", 'S',.v.s = NULL, NULL };
@@ -131,12 +183,32 @@ static int commit_fits(sfts_t *f, int nuke) {
     return p2sc_create_file(nuke, f->name, f->ptr, f->size);
 }
 
+/* unwinding after a recovered fatal error: no commit */
+static void sfts_abort(void *ptr) {
+    sfts_t *f = (sfts_t *) ptr;
+    int st = 0;
+
+    if (f->fts)
+        fits_close_file(f->fts, &st);
+    hdr_free(f->hdr);
+    if (f->view)
+        g_bytes_unref(f->view);
+    g_free(f->mem);
+    g_free(f->sums);
+    g_free(f->ptr);
+    g_free(f->name);
+    memset(f, 0, sizeof *f);
+    g_free(f);
+}
+
 char *sfts_free(sfts_t *f) {
     char *ret = NULL;
 
     if (f) {
         int *s = &f->stat;
 
+        p2sc_ctx_unguard(f->ctx, f);
+
         /* temporary file in memory */
         if (!f->name) {
             fits_close_file(f->fts, s);
@@ -146,11 +218,16 @@ char *sfts_free(sfts_t *f) {
 
         /* commit memory file to disk */
         if (f->ptr) {
-            /* write history & chksum */
-            fits_write_chksum(f->fts, s);
-            const char *h = p2sc_get_string("history");
+            /* write history & chksum, the data unit is summed again unless just written */
+            int cur = 0;
+            if (fits_get_hdu_num(f->fts, &cur) == f->sumhdu)
+                fits_update_chksum(f->fts, s);
+            else
+                fits_write_chksum(f->fts, s);
+            char *h = p2sc_ctx_dup_string(f->ctx, "history");
             if (h)
                 fits_write_history(f->fts, h, s);
+            g_free(h);
 
           restart:
             if (commit_fits(f, 0)) {
@@ -172,6 +249,11 @@ char *sfts_free(sfts_t *f) {
 
         ret = g_strdup(f->name);
 
+        hdr_free(f->hdr);
+        if (f->view)
+            g_bytes_unref(f->view);
+        g_free(f->mem);
+        g_free(f->sums);
         g_free(f->ptr);
         g_free(f->name);
         memset(f, 0, sizeof *f);
@@ -185,6 +267,8 @@ sfts_t *sfts_create(const char *name, const char *tmpl) {
     sfts_t *f = (sfts_t *) g_malloc0(sizeof *f);
     int *s = &f->stat;
 
+    f->ctx = p2sc_ctx_current();
+    p2sc_ctx_guard(f->ctx, sfts_abort, f);
     if (name)
         f->name = g_strdup(name);
     fits_create_memfile(&f->fts, &f->ptr, &f->size, 0, g_realloc, s);
@@ -216,12 +300,162 @@ sfts_t *sfts_create(const char *name, const char *tmpl) {
     return f;
 }
 
+static void unmap(void *map) {
+    g_bytes_unref((GBytes *) map);
+}
+
+/*
+   whole FITS file for the checksums: mapped, or the inflated gzip; NULL
+   for headers only, URLs, extended file names
+ */
+static GBytes *map_fits(sfts_t *f) {
+    GBytes *map = NULL;
+
+    if (f->headonly)
+        return NULL;
+    if (f->mem)
+        map = g_bytes_new_static(f->mem, f->memsize);
+    else {
+        GMappedFile *m = g_mapped_file_new(f->name, FALSE, NULL);
+
+        if (m && g_mapped_file_get_length(m) >= 2880) {
+            /* read once front to back */
+            posix_madvise(g_mapped_file_get_contents(m), g_mapped_file_get_length(m),
+                          POSIX_MADV_SEQUENTIAL);
+            map = g_bytes_new_with_free_func(g_mapped_file_get_contents(m),
+                                             g_mapped_file_get_length(m),
+                                             (GDestroyNotify) g_mapped_file_unref, m);
+        } else if (m)
+            g_mapped_file_unref(m);
+    }
+
+    if (map && (g_bytes_get_size(map) < 2880 ||
+                memcmp(g_bytes_get_data(map, NULL), "SIMPLE  =", 9))) {
+        g_bytes_unref(map);
+        map = NULL;
+    }
+    if (map)
+        p2sc_ctx_guard(f->ctx, unmap, map);
+
+    return map;
+}
+
+static void unmap_fits(sfts_t *f, GBytes *map) {
+    if (map) {
+        p2sc_ctx_unguard(f->ctx, map);
+        g_bytes_unref(map);
+    }
+}
+
+/* a gzip file inflated in memory with its block sums, NULL for anything else */
+static void *gunzip_fits(const char *name, size_t *len, guint32 **sums) {
+    GMappedFile *m = g_mapped_file_new(name, FALSE, NULL);
+    guint8 *out = NULL;
+
+    if (!m)
+        return NULL;
+
+    const guint8 *p = (const guint8 *) g_mapped_file_get_contents(m);
+    size_t n = g_mapped_file_get_length(m);
+    if (n >= 18 && p[0] == 0x1f && p[1] == 0x8b) {
+        posix_madvise((void *) p, n, POSIX_MADV_SEQUENTIAL);
+        out = p2sc_gunzip_sums(p, n, len, 2880, sums);
+    }
+    g_mapped_file_unref(m);
+
+    /* left to cfitsio to report */
+    if (out && (*len < 2880 || memcmp(out, "SIMPLE  =", 9))) {
+        g_free(*sums);
+        g_free(out);
+        *sums = NULL;
+        out = NULL;
+    }
+    return out;
+}
+
+/* sum of the file bytes [a, b) from the block sums, continued from sum; 0 if none */
+static int sums_fold(const sfts_t *f, LONGLONG a, LONGLONG b, guint32 *sum) {
+    if (!f->sums || a % 2880 || b % 2880 || (size_t) b > f->memsize)
+        return 0;
+
+    for (LONGLONG k = a / 2880; k < b / 2880; ++k)
+        *sum = p2sc_fits_sum_add(*sum, f->sums[k]);
+    return 1;
+}
+
+/* data unit and header of the current HDU inside the map, NULL if not */
+static const guint8 *map_hdu(sfts_t *f, GBytes *map, LONGLONG *hs, LONGLONG *ds, LONGLONG *de) {
+    fits_get_hduaddrll(f->fts, hs, ds, de, &f->stat);
+    CHK_FTS(f);
+    if (!map || (size_t) *de > g_bytes_get_size(map) || (*de - *ds) % 4)
+        return NULL;
+
+    const guint8 *data = (const guint8 *) g_bytes_get_data(map, NULL);
+    if (memcmp(data + *hs, "SIMPLE  =", 9) && memcmp(data + *hs, "XTENSION=", 9))
+        return NULL;
+    return data;
+}
+
+/* as fits_verify_chksum(): a missing or blank keyword is not checked */
+static const char *bad_sums(sfts_t *f, guint32 datasum, guint32 hdusum) {
+    const char *bad = NULL;
+
+    char *key = sfts_read_keystring0(f, "DATASUM");
+    if (key && *key && strtoul(key, NULL, 10) != datasum)
+        bad = "DATASUM";
+    g_free(key);
+
+    key = sfts_read_keystring0(f, "CHECKSUM");
+    if (!bad && key && *key && hdusum != 0 && hdusum != 0xffffffff)
+        bad = "CHECKSUM";
+    g_free(key);
+
+    return bad;
+}
+
+static void verify_hdu(sfts_t *f, GBytes *map) {
+    int dataok, hduok;
+    LONGLONG hs, ds, de;
+
+    /* the data unit summed across threads, the header sum continues from it */
+    const guint8 *data = map_hdu(f, map, &hs, &ds, &de);
+    if (data) {
+        guint32 datasum = 0, hdusum;
+        if (!sums_fold(f, ds, de, &datasum))
+            datasum = p2sc_fits_sum_mt(data + ds, de - ds, 0);
+        hdusum = datasum;
+        if (!sums_fold(f, hs, ds, &hdusum))
+            hdusum = p2sc_fits_sum(data + hs, ds - hs, datasum);
+        const char *bad = bad_sums(f, datasum, hdusum);
+
+        if (bad)
+            P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: incorrect %s: %s", bad, f->name);
+        return;
+    }
+
+    fits_verify_chksum(f->fts, &dataok, &hduok, &f->stat);
+    CHK_FTS(f);
+
+    if (dataok == -1)
+        P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: incorrect DATASUM: %s", f->name);
+    if (hduok == -1)
+        P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: incorrect CHECKSUM: %s", f->name);
+}
+
 sfts_t *sfts_openro(const char *name, ...) {
     sfts_t *f = (sfts_t *) g_malloc0(sizeof *f);
     int *s = &f->stat, no_verify = 0;
 
+    f->ctx = p2sc_ctx_current();
+    p2sc_ctx_guard(f->ctx, sfts_abort, f);
     f->name = g_strdup(name);
-    fits_open_file(&f->fts, name, READONLY, s);
+
+    /* gzip inflated here rather than by cfitsio, kept for the mapped paths */
+    f->mem = gunzip_fits(name, &f->memsize, &f->sums);
+    if (f->mem)
+        fits_open_memfile(&f->fts, name, READONLY, &f->mem, &f->memsize, 0, NULL, s);
+    else
+        fits_open_file(&f->fts, name, READONLY, s);
 
     va_list args;
 
@@ -229,25 +463,155 @@ sfts_t *sfts_openro(const char *name, ...) {
     no_verify = va_arg(args, int);
     va_end(args);
 
+    CHK_FTS(f);
+
     /* verify checksums */
-    if (no_verify != SFTS_SUM_NOVERIFY) {
-        int dataok, hduok, i, num = sfts_get_nhdus(f);
+    if (no_verify == SFTS_SUM_DEFER)
+        f->verify = 1;
+    else if (no_verify != SFTS_SUM_NOVERIFY) {
+        int i, num = sfts_get_nhdus(f);
+        GBytes *map = map_fits(f);
+
         for (i = 1; i <= num; ++i) {
             sfts_goto_hdu(f, i);
-            fits_verify_chksum(f->fts, &dataok, &hduok, s);
-            CHK_FTS(f);
-
-            if (dataok == -1)
-                P2SC_Msg(LVL_FATAL_FITS, "FITS: incorrect DATASUM: %s", name);
-            if (hduok == -1)
-                P2SC_Msg(LVL_FATAL_FITS, "FITS: incorrect CHECKSUM: %s", name);
+            verify_hdu(f, map);
         }
+        unmap_fits(f, map);
         sfts_goto_hdu(f, 1);
     }
 
     return f;
 }
 
+/* value field of a keyword in a raw header, NULL if missing */
+static const char *head_value(const char *h, size_t len, const char *key) {
+    char name[9];
+
+    g_snprintf(name, sizeof name, "%-8s", key);
+    for (size_t i = 0; i + 80 <= len; i += 80)
+        if (!memcmp(h + i, name, 8) && h[i + 8] == '=')
+            return h + i + 10;
+    return NULL;
+}
+
+static gint64 head_int(const char *h, size_t len, const char *key, gint64 dflt) {
+    const char *v = head_value(h, len, key);
+    return v ? g_ascii_strtoll(v, NULL, 10) : dflt;
+}
+
+/* bytes of the data unit, padded */
+static gint64 head_datasize(const char *h, size_t len, int primary) {
+    gint64 naxis = head_int(h, len, "NAXIS", 0), n = 1;
+
+    if (naxis <= 0)
+        return 0;
+    for (int i = 1; i <= naxis; ++i) {
+        char key[9];
+        gint64 v;
+
+        g_snprintf(key, sizeof key, "NAXIS%d", i);
+        v = head_int(h, len, key, 0);
+        /* random groups */
+        if (primary && i == 1 && !v && naxis > 1)
+            continue;
+        n *= v;
+    }
+
+    gint64 bitpix = head_int(h, len, "BITPIX", 8);
+    n = ABS(bitpix) / 8 * head_int(h, len, "GCOUNT", 1) * (head_int(h, len, "PCOUNT", 0) + n);
+    return (n + 2879) / 2880 * 2880;
+}
+
+/* one header, block by block until END; 0 at the end of the file */
+static size_t read_head(int fd, off_t off, GByteArray *h) {
+    guint8 block[2880];
+
+    g_byte_array_set_size(h, 0);
+    while (pread(fd, block, sizeof block, off + h->len) == sizeof block) {
+        g_byte_array_append(h, block, sizeof block);
+        for (size_t i = 0; i < sizeof block; i += 80)
+            if (!memcmp(block + i, "END     ", 8))
+                return h->len;
+    }
+    return 0;
+}
+
+/*
+   headers only: the first HDU with that keyword, or the last one, read
+   block by block without the data units and opened in memory
+ */
+sfts_t *sfts_openhdr(const char *name, const char *key) {
+    static const char *stub[] = {
+        "SIMPLE  =                    T", "BITPIX  =                    8",
+        "NAXIS   =                    0", "EXTEND  =                    T", "END"
+    };
+    int fd = open(name, O_RDONLY), hdu = 0;
+    GByteArray *h = g_byte_array_new(), *last = g_byte_array_new();
+    off_t off = 0;
+
+    for (int i = 1; fd >= 0; ++i) {
+        size_t n = read_head(fd, off, h);
+
+        if (!n || memcmp(h->data, i == 1 ? "SIMPLE  =" : "XTENSION=", 9))
+            break;
+
+        GByteArray *t = last;
+        last = h, h = t, hdu = i;
+        if (head_value((const char *) last->data, n, key))
+            break;
+        off += n + head_datasize((const char *) last->data, n, i == 1);
+    }
+    if (fd >= 0)
+        close(fd);
+    g_byte_array_free(h, TRUE);
+
+    /* gzip, URLs, extended file names */
+    if (!hdu) {
+        g_byte_array_free(last, TRUE);
+
+        sfts_t *f = sfts_openro(name, SFTS_SUM_NOVERIFY);
+        sfts_find_hdukey(f, key);
+        return f;
+    }
+
+    sfts_t *f = (sfts_t *) g_malloc0(sizeof *f);
+    int *s = &f->stat;
+
+    f->ctx = p2sc_ctx_current();
+    p2sc_ctx_guard(f->ctx, sfts_abort, f);
+    f->name = g_strdup(name);
+
+    /* an extension behind an empty primary */
+    size_t pre = hdu == 1 ? 0 : 2880, len = last->len;
+    f->memsize = pre + len;
+    f->mem = g_malloc(f->memsize);
+    f->headonly = 1;
+    if (pre) {
+        memset(f->mem, ' ', pre);
+        for (size_t i = 0; i < G_N_ELEMENTS(stub); ++i)
+            memcpy((char *) f->mem + 80 * i, stub[i], strlen(stub[i]));
+    }
+    memcpy((char *) f->mem + pre, last->data, len);
+    g_byte_array_free(last, TRUE);
+
+    fits_open_memfile(&f->fts, name, READONLY, &f->mem, &f->memsize, 0, NULL, s);
+    CHK_FTS(f);
+    if (pre)
+        sfts_goto_hdu(f, 2);
+
+    return f;
+}
+
+p2sc_ctx_t *sfts_get_ctx(sfts_t *f) {
+    return f->ctx;
+}
+
+void sfts_set_ctx(sfts_t *f, p2sc_ctx_t *ctx) {
+    p2sc_ctx_unguard(f->ctx, f);
+    f->ctx = ctx ? ctx : p2sc_ctx_default();
+    p2sc_ctx_guard(f->ctx, sfts_abort, f);
+}
+
 int sfts_get_nhdus(sfts_t *f) {
     int num;
 
@@ -273,62 +637,577 @@ void sfts_copy_header(sfts_t *in, sfts_t *out) {
     CHK_FTS(out);
 }
 
-void *sfts_read_image(sfts_t *f, size_t *ww, size_t *hh, int t) {
-    int *s = &f->stat, naxis = 0, ft, ls;
+void sfts_get_image_size(sfts_t *f, size_t *ww, size_t *hh) {
+    int *s = &f->stat, naxis = 0;
     long axes[] = { 1, 1 };
-    long pels[] = { 1, 1 };
 
     fits_get_img_dim(f->fts, &naxis, s);
     if (naxis != 2)
         P2SC_Msg(LVL_FATAL_FITS, "FITS: only 2D images supported: NAXIS=%d", naxis);
     fits_get_img_size(f->fts, 2, axes, s);
+    CHK_FTS(f);
 
-    size_t w = axes[0], h = axes[1];
+    *ww = axes[0];
+    *hh = axes[1];
+}
 
-    switch (t) {
+int sfts_get_image_type(sfts_t *f, double *bscale, double *bzero) {
+    int *s = &f->stat, bitpix = 0;
+    sfkey_t k = {.c = NULL };
+
+    fits_get_img_type(f->fts, &bitpix, s);
+    CHK_FTS(f);
+
+    k.k = "BSCALE", k.t = 'F';
+    *bscale = sfts_read_keymaybe(f, &k) == 1 ? k.v.f : 1;
+    k.k = "BZERO", k.t = 'F';
+    *bzero = sfts_read_keymaybe(f, &k) == 1 ? k.v.f : 0;
+
+    switch (bitpix) {
+    case BYTE_IMG:
+        return SUINT8;
+    case SHORT_IMG:
+        return SINT16;
+    case LONG_IMG:
+        return SINT32;
+    case LONGLONG_IMG:
+        return SINT64;
+    case FLOAT_IMG:
+        return SFLOAT;
+    case DOUBLE_IMG:
+        return SDOUBLE;
+    default:
+        P2SC_Msg(LVL_FATAL_FITS, "FITS: BITPIX not supported: %d", bitpix);
+        return 0;
+    }
+}
+
+typedef void (*conv_func_t)(void *, const guint8 *, size_t, double, double);
+
+static void conv_i16_raw(void *dst, const guint8 *src, size_t n,
+                         double bs G_GNUC_UNUSED, double bz G_GNUC_UNUSED) {
+    gint16 *d = (gint16 *) dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (gint16) (src[2 * i] << 8 | src[2 * i + 1]);
+}
+
+static void conv_u8_float(void *dst, const guint8 *src, size_t n, double bs, double bz) {
+    float *d = (float *) dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = bs * src[i] + bz;
+}
+
+static void conv_i16_float(void *dst, const guint8 *src, size_t n, double bs, double bz) {
+    float *d = (float *) dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = bs * (gint16) (src[2 * i] << 8 | src[2 * i + 1]) + bz;
+}
+
+static void conv_i32_float(void *dst, const guint8 *src, size_t n, double bs, double bz) {
+    float *d = (float *) dst;
+    for (size_t i = 0; i < n; ++i) {
+        guint32 v;
+        memcpy(&v, src + 4 * i, 4);
+        d[i] = bs * (gint32) GUINT32_FROM_BE(v) + bz;
+    }
+}
+
+static void conv_f32_float(void *dst, const guint8 *src, size_t n, double bs, double bz) {
+    float *d = (float *) dst;
+    int scaled = bs != 1 || bz != 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        union {
+            guint32 u;
+            float f;
+        } v;
+        memcpy(&v.u, src + 4 * i, 4);
+        v.u = GUINT32_FROM_BE(v.u);
+        d[i] = scaled ? bs * v.f + bz : v.f;
+    }
+}
+
+static void conv_f64_float(void *dst, const guint8 *src, size_t n, double bs, double bz) {
+    float *d = (float *) dst;
+    for (size_t i = 0; i < n; ++i) {
+        union {
+            guint64 u;
+            double f;
+        } v;
+        memcpy(&v.u, src + 8 * i, 8);
+        v.u = GUINT64_FROM_BE(v.u);
+        d[i] = bs * v.f + bz;
+    }
+}
+
+#define SUM_CHUNK (1 << 18)
+
+/*
+   uncompressed image of a plain file, converted chunk by chunk from the map
+   and, to verify, summed on the way, each chunk read from memory once; NULL
+   when not possible, nothing verified then
+ */
+static void *read_mapped(sfts_t *f, GBytes *map, size_t w, size_t h, int t, int verify) {
+    int *s = &f->stat, bitpix = 0, bpp, dsize;
+    double bs, bz;
+    conv_func_t conv = NULL;
+
+    if (!map || fits_is_compressed_image(f->fts, s) || *s) {
+        *s = 0;
+        return NULL;
+    }
+
+    int st = sfts_get_image_type(f, &bs, &bz);
+    if (t == (SINT16 | SRAW) && st == SINT16)
+        conv = conv_i16_raw, dsize = sizeof(gint16);
+    else if (t == SFLOAT) {
+        dsize = sizeof(float);
+        switch (st) {
+        case SUINT8:
+            conv = conv_u8_float;
+            break;
+        case SINT16:
+            conv = conv_i16_float;
+            break;
+        case SINT32:
+            conv = conv_i32_float;
+            break;
+        case SFLOAT:
+            conv = conv_f32_float;
+            break;
+        case SDOUBLE:
+            conv = conv_f64_float;
+            break;
+        }
+    }
+    if (!conv)
+        return NULL;
+
+    fits_get_img_type(f->fts, &bitpix, s);
+    bpp = ABS(bitpix) / 8;
+
+    LONGLONG hs, ds, de;
+    size_t npix = w * h;
+    const guint8 *data = map_hdu(f, map, &hs, &ds, &de);
+    if (!data || (size_t) (de - ds) < npix * bpp)
+        return NULL;
+
+    guint8 *pix = (guint8 *) g_malloc(npix * dsize);
+    guint32 datasum = 0;
+    const guint8 *d0 = data + ds;
+    /* an inflated gzip was summed while inflated */
+    int summed = verify && sums_fold(f, ds, de, &datasum);
+
+    for (size_t a = 0, total = de - ds; a < total; a += SUM_CHUNK) {
+        size_t b = MIN(a + SUM_CHUNK, total);
+        if (verify && !summed)
+            datasum = p2sc_fits_sum(d0 + a, b - a, datasum);
+
+        /* whole pixels, SUM_CHUNK is a multiple of 8 */
+        size_t n = a / bpp, n1 = MIN(b / bpp, npix);
+        while (n < n1) {
+            size_t j = n / w, i = n % w, run = MIN(w - i, n1 - n);
+
+            conv(pix + ((h - 1 - j) * w + i) * dsize, d0 + n * bpp, run, bs, bz);
+            n += run;
+        }
+    }
+
+    /* the HDU sum includes the header with its CHECKSUM */
+    guint32 hdusum = datasum;
+    if (verify && !sums_fold(f, hs, ds, &hdusum))
+        hdusum = p2sc_fits_sum(data + hs, ds - hs, datasum);
+    const char *bad = verify ? bad_sums(f, datasum, hdusum) : NULL;
+    if (bad) {
+        g_free(pix);
+        P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: incorrect %s: %s", bad, f->name);
+    }
+
+    return pix;
+}
+
+/* deferred checksums of the other HDUs, usually headers only */
+static void verify_others(sfts_t *f, GBytes *map) {
+    int cur = 0, num = sfts_get_nhdus(f);
+
+    fits_get_hdu_num(f->fts, &cur);
+    for (int i = 1; i <= num; ++i)
+        if (i != cur) {
+            sfts_goto_hdu(f, i);
+            verify_hdu(f, map);
+        }
+    sfts_goto_hdu(f, cur);
+}
+
+typedef struct {
+    int ctype, bytepix, blocksize;
+    /* image, nominal tile, tiles per row */
+    size_t w, h, tw, th, ntx;
+    int ntiles;
+    /* compressed bytes of each tile */
+    const guint8 *cbuf;
+    const size_t *coff, *clen;
+    double bs, bz;
+    int raw;
+    void *pix;
+    gint failed;
+} tiles_t;
+
+/* integer tile of n pixels into v, NULL on error */
+static gint32 *decode_tile(const tiles_t *d, int k, size_t n, gint32 *v, void **scratch, size_t *ssize) {
+    guint8 *c = (guint8 *) d->cbuf + d->coff[k];
+    size_t i, len = d->clen[k];
+
+    if (d->ctype == RICE_1) {
+        if (d->bytepix == 4)
+            return fits_rdecomp(c, len, (unsigned int *) v, n, d->blocksize) ? NULL : v;
+
+        /* narrow values at the end of v, widened front to back */
+        if (d->bytepix == 2) {
+            guint16 *u = (guint16 *) (v + n) - n;
+            if (fits_rdecomp_short(c, len, u, n, d->blocksize))
+                return NULL;
+            for (i = 0; i < n; ++i)
+                v[i] = (gint16) u[i];
+        } else {
+            guint8 *u = (guint8 *) (v + n) - n;
+            if (fits_rdecomp_byte(c, len, u, n, d->blocksize))
+                return NULL;
+            for (i = 0; i < n; ++i)
+                v[i] = u[i];
+        }
+        return v;
+    }
+
+    /* GZIP_1 big-endian values, GZIP_2 the same with their bytes shuffled */
+    int st = 0;
+    size_t out = 0;
+    if (uncompress2mem_from_mem((char *) c, len, (char **) scratch, ssize, realloc, &out, &st))
+        return NULL;
+
+    const guint8 *b = (const guint8 *) *scratch;
+    int shuffled = d->ctype == GZIP_2;
+    if (out == n)
+        for (i = 0; i < n; ++i)
+            v[i] = b[i];
+    else if (out == 2 * n)
+        for (i = 0; i < n; ++i)
+            v[i] = (gint16) (shuffled ? b[i] << 8 | b[n + i] : b[2 * i] << 8 | b[2 * i + 1]);
+    else if (out == 4 * n)
+        for (i = 0; i < n; ++i)
+            v[i] = (gint32) (shuffled ?
+                             (guint32) b[i] << 24 | b[n + i] << 16 | b[2 * n + i] << 8 | b[3 * n + i] :
+                             (guint32) b[4 * i] << 24 | b[4 * i + 1] << 16 | b[4 * i + 2] << 8 | b[4 * i + 3]);
+    else
+        return NULL;
+
+    return v;
+}
+
+static void tile_part(size_t from, size_t to, int part G_GNUC_UNUSED, void *data) {
+    tiles_t *d = (tiles_t *) data;
+    gint32 *v = (gint32 *) malloc(d->tw * d->th * sizeof *v);
+    size_t ssize = d->tw * d->th * sizeof *v;
+    void *scratch = malloc(ssize);
+
+    for (size_t k = from; v && scratch && k < to && !g_atomic_int_get(&d->failed); ++k) {
+        size_t x0 = k % d->ntx * d->tw, y0 = k / d->ntx * d->th;
+        size_t cw = MIN(d->tw, d->w - x0), ch = MIN(d->th, d->h - y0);
+
+        if (!decode_tile(d, k, cw * ch, v, &scratch, &ssize)) {
+            g_atomic_int_set(&d->failed, 1);
+            break;
+        }
+
+        /* rows straight into their flipped place */
+        for (size_t j = 0; j < ch; ++j) {
+            const gint32 *in = v + j * cw;
+            size_t o = (d->h - 1 - y0 - j) * d->w + x0;
+
+            if (d->raw) {
+                gint16 *out = (gint16 *) d->pix + o;
+                for (size_t i = 0; i < cw; ++i)
+                    out[i] = (gint16) in[i];
+            } else {
+                float *out = (float *) d->pix + o;
+                for (size_t i = 0; i < cw; ++i)
+                    out[i] = d->bs * in[i] + d->bz;
+            }
+        }
+    }
+    if (!v || !scratch)
+        g_atomic_int_set(&d->failed, 1);
+
+    free(scratch);
+    free(v);
+}
+
+/*
+   lossless RICE/GZIP tile-compressed integer image: the compressed bytes are
+   read in turn, the tiles decoded in parallel into the image; NULL when not
+   possible or on error, cfitsio reads the image then
+ */
+static void *read_tiles(sfts_t *f, size_t w, size_t h, int t) {
+    int *s = &f->stat;
+    FITSfile *F = f->fts->Fptr;
+
+    if (!fits_is_compressed_image(f->fts, s) || *s) {
+        *s = 0;
+        return NULL;
+    }
+    if ((F->compress_type != RICE_1 && F->compress_type != GZIP_1 && F->compress_type != GZIP_2) ||
+        (F->zbitpix != BYTE_IMG && F->zbitpix != SHORT_IMG && F->zbitpix != LONG_IMG) ||
+        F->cn_zscale != 0 || F->zndim != 2 || F->tilesize[0] < 1 || F->tilesize[1] < 1 ||
+        (t != SFLOAT && !(t == (SINT16 | SRAW) && F->zbitpix == SHORT_IMG)))
+        return NULL;
+
+    tiles_t d = {
+        .ctype = F->compress_type,.bytepix = F->rice_bytepix,.blocksize = F->rice_blocksize,
+        .w = w,.h = h,.tw = F->tilesize[0],.th = F->tilesize[1],
+        .bs = F->cn_bscale,.bz = F->cn_bzero,.raw = t & SRAW
+    };
+    d.ntx = (w + d.tw - 1) / d.tw;
+    d.ntiles = d.ntx * ((h + d.th - 1) / d.th);
+
+    long nrows = 0;
+    fits_get_num_rows(f->fts, &nrows, s);
+    if (*s || nrows != d.ntiles || (d.ctype == RICE_1 && d.blocksize < 1)) {
+        *s = 0;
+        return NULL;
+    }
+
+    size_t *coff = (size_t *) g_malloc0(2 * d.ntiles * sizeof *coff), *clen = coff + d.ntiles;
+    size_t total = 0;
+    int absent = 0;
+    for (int k = 0; k < d.ntiles && !*s; ++k) {
+        LONGLONG len = 0, off;
+
+        fits_read_descriptll(f->fts, F->cn_compressed, k + 1, &len, &off, s);
+        /* an uncompressed or missing tile, for cfitsio */
+        if (len <= 0) {
+            absent = 1;
+            break;
+        }
+        coff[k] = total, clen[k] = len;
+        total += len;
+    }
+    if (*s || absent) {
+        *s = 0;
+        g_free(coff);
+        return NULL;
+    }
+
+    guint8 *cbuf = (guint8 *) g_malloc(total);
+    for (int k = 0; k < d.ntiles && !*s; ++k)
+        fits_read_col(f->fts, TBYTE, F->cn_compressed, k + 1, 1, clen[k], NULL, cbuf + coff[k], NULL, s);
+    if (*s) {
+        g_free(cbuf);
+        g_free(coff);
+        CHK_FTS(f);
+    }
+
+    d.cbuf = cbuf, d.coff = coff, d.clen = clen;
+    d.pix = g_malloc(w * h * (d.raw ? sizeof(gint16) : sizeof(float)));
+
+    /* consecutive tiles per part, any decoding error stops them all */
+    p2sc_parallel_for(d.ntiles, 1, tile_part, &d);
+
+    g_free(cbuf);
+    g_free(coff);
+    if (d.failed) {
+        g_free(d.pix);
+        return NULL;
+    }
+
+    return d.pix;
+}
+
+/* cfitsio datatype of an output pixel type, and its size */
+static size_t pix_type(int t, int *ft) {
+    switch (t & ~SRAW) {
     case SUINT16:
-        ft = TUSHORT;
-        ls = w * sizeof(guint16);
-        break;
+        *ft = TUSHORT;
+        return sizeof(guint16);
+    case SINT16:
+        *ft = TSHORT;
+        return sizeof(gint16);
     case SUINT32:
-        ft = TUINT;
-        ls = w * sizeof(guint32);
-        break;
+        *ft = TUINT;
+        return sizeof(guint32);
     case SINT32:
-        ft = TINT;
-        ls = w * sizeof(gint32);
-        break;
+        *ft = TINT;
+        return sizeof(gint32);
     case SFLOAT:
-        ft = TFLOAT;
-        ls = w * sizeof(float);
-        break;
+        *ft = TFLOAT;
+        return sizeof(float);
     case SDOUBLE:
-        ft = TDOUBLE;
-        ls = w * sizeof(double);
-        break;
+        *ft = TDOUBLE;
+        return sizeof(double);
     default:
         P2SC_Msg(LVL_FATAL_FITS, "FITS: data type not implemented: %d", t);
+        return 0;
+    }
+}
+
+void *sfts_read_image(sfts_t *f, size_t *ww, size_t *hh, int t) {
+    int *s = &f->stat, naxis = 0, ft;
+    long axes[] = { 1, 1 };
+    long pels[] = { 1, 1 };
+
+    fits_get_img_dim(f->fts, &naxis, s);
+    if (naxis != 2)
+        P2SC_Msg(LVL_FATAL_FITS, "FITS: only 2D images supported: NAXIS=%d", naxis);
+    fits_get_img_size(f->fts, 2, axes, s);
+
+    size_t w = axes[0], h = axes[1], ls = w * pix_type(t, &ft);
+
+    GBytes *map = map_fits(f);
+    void *pix;
+
+    if (f->verify) {
+        f->verify = 0;
+        verify_others(f, map);
+
+        pix = read_mapped(f, map, w, h, t, 1);
+        if (!pix)
+            /* two passes */
+            verify_hdu(f, map);
+    } else
+        pix = read_mapped(f, map, w, h, t, 0);
+    unmap_fits(f, map);
+
+    if (pix) {
+        *ww = w;
+        *hh = h;
+        return pix;
+    }
+
+    void *tiled = read_tiles(f, w, h, t);
+    if (tiled) {
+        *ww = w;
+        *hh = h;
+        return tiled;
+    }
+
+    double bscale = 1, bzero = 0;
+    if (t & SRAW) {
+        sfts_get_image_type(f, &bscale, &bzero);
+        fits_set_bscale(f->fts, 1, 0, s);
+    }
+
+    /* each row straight into its flipped place, compressed tiles are cached by cfitsio */
+    pix = g_malloc(h * ls);
+    for (size_t j = 0; j < h && !*s; ++j) {
+        pels[1] = j + 1;
+        fits_read_pix(f->fts, ft, pels, w, NULL, (guint8 *) pix + (h - 1 - j) * ls, NULL, s);
+    }
+
+    if (t & SRAW)
+        fits_set_bscale(f->fts, bscale, bzero, s);
+    CHK_FTS(f);
+
+    *ww = w;
+    *hh = h;
+    return pix;
+}
+
+void *sfts_read_region(sfts_t *f, size_t x, size_t y, size_t w, size_t h, size_t step,
+                       size_t *ww, size_t *hh, int t) {
+    int *s = &f->stat, ft;
+    size_t iw, ih;
+
+    sfts_get_image_size(f, &iw, &ih);
+    if (!step || x >= iw || y >= ih || !w || !h)
+        P2SC_CtxMsg(f->ctx, LVL_FATAL_FITS, "FITS: region %zu,%zu,%zu,%zu/%zu outside %zux%zu: %s",
+                    x, y, w, h, step, iw, ih, f->name);
+    w = MIN(w, iw - x), h = MIN(h, ih - y);
+
+    /* all of the data unit is summed anyway */
+    if (f->verify) {
+        GBytes *map = map_fits(f);
+
+        f->verify = 0;
+        verify_others(f, map);
+        verify_hdu(f, map);
+        unmap_fits(f, map);
+    }
+
+    /* rows counted from the top, FITS rows from the bottom */
+    size_t nw = (w + step - 1) / step, nh = (h + step - 1) / step, ls = nw * pix_type(t, &ft);
+    long fpix[] = { x + 1, ih - y - (nh - 1) * step };
+    long lpix[] = { x + (nw - 1) * step + 1, ih - y };
+    long inc[] = { step, step };
+
+    double bscale = 1, bzero = 0;
+    if (t & SRAW) {
+        sfts_get_image_type(f, &bscale, &bzero);
+        fits_set_bscale(f->fts, 1, 0, s);
+    }
+
+    /* one call: cfitsio decompresses only the tiles the region overlaps */
+    guint8 *pix = (guint8 *) g_malloc(nh * ls), *row = (guint8 *) g_malloc(ls);
+    fits_read_subset(f->fts, ft, fpix, lpix, inc, NULL, pix, NULL, s);
+    for (size_t j = 0; j < nh / 2; ++j) {
+        memcpy(row, pix + j * ls, ls);
+        memcpy(pix + j * ls, pix + (nh - 1 - j) * ls, ls);
+        memcpy(pix + (nh - 1 - j) * ls, row, ls);
+    }
+    g_free(row);
+
+    if (t & SRAW)
+        fits_set_bscale(f->fts, bscale, bzero, s);
+    if (*s)
+        g_free(pix);
+    CHK_FTS(f);
+
+    *ww = nw;
+    *hh = nh;
+    return pix;
+}
+
+const void *sfts_map_image(sfts_t *f, size_t *ww, size_t *hh, int t) {
+    int *s = &f->stat, naxis = 0, bitpix = 0;
+    long axes[] = { 1, 1 };
+    double bs, bz;
+
+    fits_get_img_dim(f->fts, &naxis, s);
+    if (fits_is_compressed_image(f->fts, s) || naxis != 2 || *s) {
+        *s = 0;
         return NULL;
     }
+    if ((t & ~SRAW) != sfts_get_image_type(f, &bs, &bz))
+        return NULL;
 
-    void *pix = g_malloc(h * ls);
-    fits_read_pix(f->fts, ft, pels, w * h, NULL, pix, NULL, s);
+    fits_get_img_size(f->fts, 2, axes, s);
+    fits_get_img_type(f->fts, &bitpix, s);
     CHK_FTS(f);
 
-    void *line = g_malloc(ls);
-    for (size_t j = 0; j < h / 2; ++j) {
-        void *first = (guint8 *) pix + j * ls;
-        void *last = (guint8 *) pix + (h - 1 - j) * ls;
+    LONGLONG hs, ds, de;
+    size_t w = axes[0], h = axes[1];
+    GBytes *map = map_fits(f);
+    const guint8 *data = map_hdu(f, map, &hs, &ds, &de);
+
+    if (!data || (size_t) (de - ds) < w * h * (ABS(bitpix) / 8)) {
+        unmap_fits(f, map);
+        return NULL;
+    }
 
-        memcpy(line, last, ls);
-        memcpy(last, first, ls);
-        memcpy(first, line, ls);
+    /* deferred checksums, one pass over the map */
+    if (f->verify) {
+        f->verify = 0;
+        verify_others(f, map);
+        verify_hdu(f, map);
     }
-    g_free(line);
+
+    /* owned by f from now on */
+    p2sc_ctx_unguard(f->ctx, map);
+    if (f->view)
+        g_bytes_unref(f->view);
+    f->view = map;
 
     *ww = w;
     *hh = h;
-    return pix;
+    return data + ds;
 }
 
 void sfts_create_image(sfts_t *f, size_t w, size_t h, int t) {
@@ -362,6 +1241,41 @@ void sfts_create_image(sfts_t *f, size_t w, size_t h, int t) {
     CHK_FTS(f);
 }
 
+/*
+   DATASUM of an image just written, summed in the memory file rather than
+   read back by cfitsio; the header sum is left to fits_update_chksum()
+ */
+static void write_chksum(sfts_t *f) {
+    int *s = &f->stat;
+    LONGLONG hs, ds, de;
+
+    if (!f->ptr) {
+        fits_write_chksum(f->fts, s);
+        return;
+    }
+
+    /* both keywords first, the header may grow */
+    fits_update_key(f->fts, TSTRING, "DATASUM", (void *) "0", "data unit checksum", s);
+    fits_update_key(f->fts, TSTRING, "CHECKSUM", (void *) "0000000000000000", "HDU checksum", s);
+    fits_set_hdustruc(f->fts, s);
+    fits_flush_buffer(f->fts, 0, s);
+    fits_get_hduaddrll(f->fts, &hs, &ds, &de, s);
+    if (*s)
+        return;
+
+    if ((size_t) de > f->size) {
+        fits_write_chksum(f->fts, s);
+        return;
+    }
+
+    char sum[FLEN_VALUE];
+    snprintf(sum, sizeof sum, "%u", p2sc_fits_sum_mt((guint8 *) f->ptr + ds, de - ds, 0));
+    fits_update_key(f->fts, TSTRING, "DATASUM", sum, "data unit checksum", s);
+    fits_update_chksum(f->fts, s);
+
+    fits_get_hdu_num(f->fts, &f->sumhdu);
+}
+
 void sfts_write_image(sfts_t *f, const void *pix, size_t w, size_t h, int t) {
     int *s = &f->stat, ft, ls;
     long pels[] = { 1, 1 };
@@ -396,15 +1310,13 @@ void sfts_write_image(sfts_t *f, const void *pix, size_t w, size_t h, int t) {
         return;
     }
 
-    void *line = g_malloc(ls);
-    for (size_t j = 0; j < h; ++j) {
+    /* cfitsio does not write to the array */
+    for (size_t j = 0; j < h && !*s; ++j) {
         pels[1] = j + 1;
-        memcpy(line, (const guint8 *) pix + (h - 1 - j) * ls, ls);
-        fits_write_pix(f->fts, ft, pels, w, line, s);
+        fits_write_pix(f->fts, ft, pels, w, (guint8 *) pix + (h - 1 - j) * ls, s);
     }
-    g_free(line);
 
-    fits_write_chksum(f->fts, s);
+    write_chksum(f);
     CHK_FTS(f);
 }
 
@@ -472,6 +1384,129 @@ void sfts_write_comment(sfts_t *f, const char *cmnt) {
     CHK_FTS(f);
 }
 
+static hindex_t *hdr_new(sfts_t *f, int hdu) {
+    int *s = &f->stat, n = 0;
+    char *str = NULL;
+
+    /* all cards in one pass, END last */
+    fits_hdr2str(f->fts, 0, NULL, 0, &str, &n, s);
+    CHK_FTS(f);
+
+    hindex_t *x = (hindex_t *) g_malloc0(sizeof *x);
+    x->hdu = hdu;
+    x->cards = g_array_sized_new(FALSE, FALSE, sizeof(card_t), n);
+    x->keys = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (int i = 0; i < n; ++i) {
+        char card[FLEN_CARD], name[FLEN_KEYWORD], val[FLEN_VALUE], com[FLEN_COMMENT];
+        int len, kst = 0, st = 0;
+
+        memcpy(card, str + 80 * i, 80);
+        card[80] = 0;
+        for (len = 79; len >= 0 && card[len] == ' '; --len)
+            card[len] = 0;
+        if (!strcmp(card, "END"))
+            break;
+
+        fits_get_keyname(card, name, &len, &kst);
+        /* the value of a CONTINUE card starts in column 11 */
+        if (!kst && !strcmp(name, "CONTINUE") && strlen(card) > 10) {
+            char tmp[FLEN_CARD] = "D2345678= ";
+
+            strcpy(tmp + 10, card + 10);
+            fits_parse_value(tmp, val, com, &st);
+        } else if (!kst)
+            fits_parse_value(card, val, com, &st);
+
+        /* no value: hdr_card() leaves the keyword to cfitsio, which reports the error */
+        x->bad |= kst || st;
+        card_t c = {
+            .key = g_strdup(kst ? "" : name),
+            .val = kst || st ? NULL : g_strdup(val),
+            .com = g_strdup(kst || st ? "" : com)
+        };
+        g_array_append_val(x->cards, c);
+        if (!g_hash_table_contains(x->keys, c.key))
+            g_hash_table_insert(x->keys, c.key, GINT_TO_POINTER(x->cards->len));
+    }
+    fits_free_memory(str, s);
+
+    return x;
+}
+
+/* index of the current HDU, files being written are not indexed */
+static const hindex_t *hdr_index(sfts_t *f) {
+    int cur = 0;
+
+    if (f->ptr)
+        return NULL;
+
+    fits_get_hdu_num(f->fts, &cur);
+    if (!f->hdr || f->hdr->hdu != cur) {
+        hdr_free(f->hdr);
+        f->hdr = NULL;
+        f->hdr = hdr_new(f, cur);
+    }
+    return f->hdr;
+}
+
+/*
+   card of the keyword, KEY_NO_EXIST status if absent; NULL with no status
+   if cfitsio should read it: wildcards, HIERARCH, unparsed value
+ */
+static const card_t *hdr_card(sfts_t *f, const char *key) {
+    const hindex_t *x = hdr_index(f);
+
+    if (!x || strlen(key) > 8 || strpbrk(key, " ?*#"))
+        return NULL;
+
+    char *up = g_ascii_strup(key, -1);
+    int i = GPOINTER_TO_INT(g_hash_table_lookup(x->keys, up));
+    g_free(up);
+
+    if (!i) {
+        f->stat = KEY_NO_EXIST;
+        return NULL;
+    }
+
+    const card_t *c = &g_array_index(x->cards, card_t, i - 1);
+    return c->val ? c : NULL;
+}
+
+/* value of card i with its CONTINUE cards, comments joined as cfitsio does */
+static char *hdr_longstr(const hindex_t *x, guint i, char *com) {
+    const card_t *c = &g_array_index(x->cards, card_t, i);
+    char buf[FLEN_VALUE];
+    int st = 0;
+
+    g_strlcpy(com, c->com, FLEN_COMMENT);
+    if (!c->val || !*c->val)
+        return g_strdup("");
+
+    ffc2s(c->val, buf, &st);
+    GString *v = g_string_new(buf);
+
+    while (v->len && v->str[v->len - 1] == '&' && ++i < x->cards->len) {
+        const card_t *n = &g_array_index(x->cards, card_t, i);
+        if (strcmp(n->key, "CONTINUE") || (!(n->val && *n->val) && !*n->com))
+            break;
+
+        g_string_truncate(v, v->len - 1);
+        if (n->val && *n->val) {
+            st = 0;
+            ffc2s(n->val, buf, &st);
+            g_string_append(v, buf);
+        }
+        if (*n->com) {
+            if (*com)
+                g_strlcat(com, " ", FLEN_COMMENT);
+            g_strlcat(com, n->com, FLEN_COMMENT);
+        }
+    }
+
+    return g_string_free(v, FALSE);
+}
+
 static int sfts_read_key_internal(sfts_t *f, sfkey_t *k) {
     int *s = &f->stat;
 
@@ -480,20 +1515,34 @@ static int sfts_read_key_internal(sfts_t *f, sfkey_t *k) {
         return 0;
     }
 
+    /* from the index, with the conversions of fits_read_key() */
+    const card_t *c = hdr_card(f, k->k);
+    LONGLONG ll;
+
     switch (k->t) {
     case 'S':
         *k->v.s = 0;
-        fits_read_key(f->fts, TSTRING, k->k, k->v.s, NULL, s);
+        if (c)
+            ffc2s(c->val, k->v.s, s);
+        else if (!*s)
+            fits_read_key(f->fts, TSTRING, k->k, k->v.s, NULL, s);
         break;
     case 'I':
         /* long long */
         k->v.i = 0;
-        fits_read_key(f->fts, TLONGLONG, k->k, &k->v.i, NULL, s);
+        if (c) {
+            ffc2j(c->val, &ll, s);
+            k->v.i = *s ? 0 : ll;
+        } else if (!*s)
+            fits_read_key(f->fts, TLONGLONG, k->k, &k->v.i, NULL, s);
         break;
     case 'F':
         /* double */
         k->v.f = 0;
-        fits_read_key(f->fts, TDOUBLE, k->k, &k->v.f, NULL, s);
+        if (c)
+            ffc2d(c->val, &k->v.f, s);
+        else if (!*s)
+            fits_read_key(f->fts, TDOUBLE, k->k, &k->v.f, NULL, s);
         break;
     default:
         P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "Keyword %s: unknown key type %d", k->k, k->t);
@@ -580,18 +1629,33 @@ char *sfts_read_history(sfts_t *f) {
     char c[SKEY_LEN], k[SKEY_LEN], *ret;
     GString *str = g_string_sized_new(SKEY_LEN);
     int *s = &f->stat, n, i, l;
-
-    fits_get_hdrpos(f->fts, &n, &i, s);
+    const hindex_t *x = hdr_index(f);
 
     g_string_append_c(str, '\"');
-    i = 0;
-    while (i < n) {
-        fits_read_record(f->fts, ++i, c, s);
-        fits_get_keyname(c, k, &l, s);
-        if (!strcmp(k, "HISTORY")) {
-            char *v = clean_string(c + 8);
-            g_string_append_printf(str, " %s", v);
-            g_free(v);
+    if (x && !x->bad) {
+        /* the text of a HISTORY card is its comment */
+        for (guint j = 0; j < x->cards->len; ++j) {
+            const card_t *h = &g_array_index(x->cards, card_t, j);
+
+            if (!strcmp(h->key, "HISTORY")) {
+                g_strlcpy(c, h->com, sizeof c);
+                char *v = clean_string(c);
+                g_string_append_printf(str, " %s", v);
+                g_free(v);
+            }
+        }
+    } else {
+        fits_get_hdrpos(f->fts, &n, &i, s);
+
+        i = 0;
+        while (i < n) {
+            fits_read_record(f->fts, ++i, c, s);
+            fits_get_keyname(c, k, &l, s);
+            if (!strcmp(k, "HISTORY")) {
+                char *v = clean_string(c + 8);
+                g_string_append_printf(str, " %s", v);
+                g_free(v);
+            }
         }
     }
     CHK_FTS(f);
@@ -603,7 +1667,58 @@ char *sfts_read_history(sfts_t *f) {
     return ret;
 }
 
+/* long strings may end in &, e.g., EUI FILE_RAW */
+static void strip_amp(char *str) {
+    int len = strlen(str);
+    if (len > 68 && str[len - 1] == '&')
+        str[len - 1] = 0;
+}
+
+static void head_indexed(const hindex_t *x, char ***keys, char ***vals, char ***coms) {
+    guint n = x->cards->len;
+
+    GArray *ak = g_array_sized_new(TRUE, FALSE, sizeof **keys, n);
+    GArray *av = g_array_sized_new(TRUE, FALSE, sizeof **vals, n);
+    GArray *ac = g_array_sized_new(TRUE, FALSE, sizeof **coms, n);
+
+    char *str, com[SKEY_LEN];
+    for (guint i = 0; i < n; ++i) {
+        const card_t *c = &g_array_index(x->cards, card_t, i);
+
+        const char *key = c->key;
+        if (!strcmp("CONTINUE", key))
+            continue;
+        if (key[0] == 0)
+            key = "COMMENT";
+
+        str = g_strdup(key);
+        g_array_append_val(ak, str);
+
+        if (strcmp("HISTORY", key) && strcmp("COMMENT", key)) {
+            str = hdr_longstr(x, i, com);
+            strip_amp(str);
+        } else {
+            str = g_strdup("");
+            g_strlcpy(com, c->com, sizeof com);
+        }
+        g_array_append_val(av, str);
+
+        str = g_strdup(com);
+        g_array_append_val(ac, str);
+    }
+
+    *keys = (char **) g_array_free(ak, FALSE);
+    *vals = (char **) g_array_free(av, FALSE);
+    *coms = (char **) g_array_free(ac, FALSE);
+}
+
 void sfts_head2str(sfts_t *f, char ***keys, char ***vals, char ***coms) {
+    const hindex_t *x = hdr_index(f);
+    if (x && !x->bad) {
+        head_indexed(x, keys, vals, coms);
+        return;
+    }
+
     int nkeys, *s = &f->stat;
     fits_get_hdrspace(f->fts, &nkeys, NULL, s);
 
@@ -625,10 +1740,7 @@ void sfts_head2str(sfts_t *f, char ***keys, char ***vals, char ***coms) {
         int regular = strcmp("HISTORY", key) && strcmp("COMMENT", key);
         if (regular) {
             fits_read_key_longstr(f->fts, key, &longstr, com, s);
-            // long strings may end in &, e.g., EUI FILE_RAW
-            int len = strlen(longstr);
-            if (len > 68 && longstr[len - 1] == '&')
-                longstr[len - 1] = 0;
+            strip_amp(longstr);
         }
 
         str = g_strdup(key);
@@ -29,7 +29,12 @@ extern "C" {
 #define SFLOAT  (1 << 8)
 #define SDOUBLE (1 << 9)
 
+/* or'ed to the type: stored values, BSCALE/BZERO not applied */
+#define SRAW    (1 << 10)
+
 #define SFTS_SUM_NOVERIFY ((int) 0xdeadbeef)
+/* checksums verified by sfts_read_image() instead, in the same pass when possible */
+#define SFTS_SUM_DEFER    ((int) 0xdefe55ed)
 
     typedef struct sfts_t sfts_t;
 
@@ -49,15 +54,38 @@ extern "C" {
 
     sfts_t *sfts_create(const char *, const char *);
     sfts_t *sfts_openro(const char *, ...);
+    /*
+       headers only, without the data units: the HDU with that keyword as
+       by sfts_find_hdukey(), for metadata; no image can be read
+     */
+    sfts_t *sfts_openhdr(const char *, const char *);
     char *sfts_free(sfts_t *);
 
+    /* the context is the thread's current one at open/create time */
+    struct p2sc_ctx_t *sfts_get_ctx(sfts_t *);
+    void sfts_set_ctx(sfts_t *, struct p2sc_ctx_t *);
+
     int sfts_get_nhdus(sfts_t *);
     void sfts_goto_hdu(sfts_t *, int);
 
     void sfts_copy(sfts_t *, sfts_t *);
     void sfts_copy_header(sfts_t *, sfts_t *);
 
+    void sfts_get_image_size(sfts_t *, size_t *, size_t *);
+    /* type of the stored values, with the BSCALE/BZERO to apply */
+    int sfts_get_image_type(sfts_t *, double *, double *);
     void *sfts_read_image(sfts_t *, size_t *, size_t *, int);
+    /*
+       the region x, y, w, h counted from the top left as sfts_read_image()
+       returns the image, every step-th pixel of it; clipped to the image
+     */
+    void *sfts_read_region(sfts_t *, size_t, size_t, size_t, size_t, size_t,
+                           size_t *, size_t *, int);
+    /*
+       stored values of an uncompressed image of that type, big-endian and
+       in file row order, mapped until sfts_free(); NULL if not possible
+     */
+    const void *sfts_map_image(sfts_t *, size_t *, size_t *, int);
     void sfts_create_image(sfts_t *, size_t, size_t, int);
     void sfts_write_image(sfts_t *, const void *, size_t, size_t, int);
 
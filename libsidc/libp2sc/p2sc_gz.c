@@ -0,0 +1,207 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <limits.h>
+#include <string.h>
+#include <glib.h>
+#include <zlib.h>
+
+#include "p2sc_gz.h"
+#include "p2sc_parallel.h"
+#include "p2sc_sum.h"
+
+/* output inflated at a time, summed while still in the cache */
+#define GZ_WINDOW (1 << 18)
+
+typedef struct {
+    const guint8 *in;
+    size_t inlen;
+    /* offset and length of the inflated member */
+    size_t off, len;
+} member_t;
+
+typedef struct {
+    const member_t *m;
+    gint nm;
+    guint8 *out;
+    gint failed;
+} members_t;
+
+static guint32 le32(const guint8 *p) {
+    return (guint32) p[0] | (guint32) p[1] << 8 | (guint32) p[2] << 16 | (guint32) p[3] << 24;
+}
+
+/* size of a BGZF member from its header (BC extra field), 0 if not one */
+static size_t bgzf_size(const guint8 *p, size_t len) {
+    if (len < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 4))
+        return 0;
+
+    size_t i = 12, end = 12 + (p[10] | p[11] << 8);
+    if (end > len)
+        return 0;
+
+    while (i + 4 <= end) {
+        size_t sl = p[i + 2] | p[i + 3] << 8;
+
+        if (p[i] == 'B' && p[i + 1] == 'C' && sl == 2 && i + 6 <= end)
+            return (size_t) (p[i + 4] | p[i + 5] << 8) + 1;
+        i += 4 + sl;
+    }
+    return 0;
+}
+
+/* all members of a BGZF file, NULL for any other gzip stream */
+static GArray *bgzf_members(const guint8 *p, size_t len) {
+    GArray *a = g_array_new(FALSE, FALSE, sizeof(member_t));
+    size_t i = 0, off = 0;
+
+    while (i < len) {
+        size_t n = bgzf_size(p + i, len - i);
+
+        if (!n || n < 18 || n > len - i) {
+            g_array_free(a, TRUE);
+            return NULL;
+        }
+
+        member_t m = {.in = p + i,.inlen = n,.off = off,.len = le32(p + i + n - 4) };
+        g_array_append_val(a, m);
+        off += m.len, i += n;
+    }
+    return a;
+}
+
+static int inflate_member(const member_t *m, guint8 *out) {
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof z);
+    if (inflateInit2(&z, 15 + 16) != Z_OK)
+        return -1;
+
+    z.next_in = (Bytef *) m->in, z.avail_in = m->inlen;
+    z.next_out = out + m->off, z.avail_out = m->len;
+    ret = inflate(&z, Z_FINISH);
+    inflateEnd(&z);
+
+    return ret == Z_STREAM_END && z.total_out == m->len ? 0 : -1;
+}
+
+static void members_part(size_t from, size_t to, int part G_GNUC_UNUSED, void *data) {
+    members_t *d = (members_t *) data;
+
+    for (size_t k = from; k < to && !g_atomic_int_get(&d->failed); ++k)
+        if (inflate_member(d->m + k, d->out))
+            g_atomic_int_set(&d->failed, 1);
+}
+
+static guint8 *inflate_members(GArray *a, size_t *outlen) {
+    const member_t *last = &g_array_index(a, member_t, a->len - 1);
+    members_t d = {.m = (const member_t *) a->data,.nm = a->len };
+
+    *outlen = last->off + last->len;
+    d.out = (guint8 *) g_malloc(MAX(*outlen, 1));
+
+    /* members are independent, each inflates into its own place */
+    p2sc_parallel_for(d.nm, 1, members_part, &d);
+
+    if (d.failed) {
+        g_free(d.out);
+        return NULL;
+    }
+    return d.out;
+}
+
+/* sums of the blocks of out completed up to n, the last partial one at the end */
+static void sum_blocks(const guint8 *out, size_t n, size_t block, guint32 *sums, size_t *done, int end) {
+    for (; *done + block <= n; *done += block)
+        sums[*done / block] = p2sc_fits_sum(out + *done, block, 0);
+    if (end && *done < n)
+        sums[*done / block] = p2sc_fits_sum(out + *done, n - *done, 0);
+}
+
+/*
+   one pass over the whole input into a buffer sized by the trailer, grown
+   only for streams beyond 4 GB or of several members; with sums, each
+   window of output is summed right after it is inflated
+ */
+static guint8 *inflate_stream(const guint8 *p, size_t len, size_t *outlen, size_t block, guint32 **sums) {
+    size_t cap = MAX(le32(p + len - 4), len), in = 0, n = 0, done = 0;
+    guint8 *out = (guint8 *) g_malloc(cap);
+    guint32 *s = sums ? (guint32 *) g_malloc(cap / block * sizeof *s + sizeof *s) : NULL;
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof z);
+    if (inflateInit2(&z, 15 + 16) != Z_OK) {
+        g_free(s);
+        g_free(out);
+        return NULL;
+    }
+
+    for (;;) {
+        if (n == cap) {
+            cap *= 2;
+            out = (guint8 *) g_realloc(out, cap);
+            if (s)
+                s = (guint32 *) g_realloc(s, cap / block * sizeof *s + sizeof *s);
+        }
+
+        z.next_in = (Bytef *) p + in, z.avail_in = MIN(len - in, UINT_MAX);
+        z.next_out = out + n, z.avail_out = MIN(cap - n, s ? GZ_WINDOW : UINT_MAX);
+        uInt ai = z.avail_in, ao = z.avail_out;
+
+        ret = inflate(&z, Z_NO_FLUSH);
+        in += ai - z.avail_in, n += ao - z.avail_out;
+        if (s)
+            sum_blocks(out, n, block, s, &done, 0);
+
+        if (ret == Z_STREAM_END) {
+            /* next member, trailing zeros are tolerated as by gzip */
+            if (len - in < 18 || p[in] != 0x1f || p[in + 1] != 0x8b)
+                break;
+            inflateReset(&z);
+        } else if (ret != Z_OK && !(ret == Z_BUF_ERROR && n == cap)) {
+            inflateEnd(&z);
+            g_free(s);
+            g_free(out);
+            return NULL;
+        }
+    }
+    inflateEnd(&z);
+
+    if (s)
+        sum_blocks(out, n, block, s, &done, 1);
+    if (sums)
+        *sums = s;
+    *outlen = n;
+    return out;
+}
+
+guint8 *p2sc_gunzip(const void *buf, size_t len, size_t *outlen) {
+    return p2sc_gunzip_sums(buf, len, outlen, 0, NULL);
+}
+
+guint8 *p2sc_gunzip_sums(const void *buf, size_t len, size_t *outlen, size_t block, guint32 **sums) {
+    const guint8 *p = (const guint8 *) buf;
+
+    if (sums)
+        *sums = NULL;
+    if (len < 18 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8)
+        return NULL;
+
+    GArray *a = bgzf_members(p, len);
+    guint8 *out;
+
+    if (a && a->len > 1)
+        out = inflate_members(a, outlen);
+    else
+        out = inflate_stream(p, len, outlen, block, block && block % 4 == 0 ? sums : NULL);
+    if (a)
+        g_array_free(a, TRUE);
+
+    return out;
+}
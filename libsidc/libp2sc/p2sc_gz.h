@@ -0,0 +1,32 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_GZ_H__
+#define __P2SC_GZ_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    /*
+       gzip data inflated into one new buffer, NULL if not gzip or corrupt;
+       the members of a BGZF file (bgzip) are inflated in parallel
+     */
+    guint8 *p2sc_gunzip(const void *, size_t, size_t *);
+    /*
+       the same, a single stream also gets the FITS sums of its blocks
+       (a multiple of 4 bytes) while inflated, the last one zero padded;
+       *sums is left NULL for BGZF
+     */
+    guint8 *p2sc_gunzip_sums(const void *, size_t, size_t *, size_t block, guint32 **sums);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
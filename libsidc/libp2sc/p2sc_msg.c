@@ -20,30 +20,44 @@ static const char _versionid_[] __attribute__((unused)) =
 
 static char *p2sc_backtrace(void);
 
+static void p2sc_vmsg(p2sc_ctx_t *, const char *, const char *, int,
+                      const char *, int, const char *, va_list);
+
 void _p2sc_msg(const char *func, const char *file, int line,
                const char *versionid, int severity, const char *fmt, ...) {
     va_list va;
+
+    va_start(va, fmt);
+    p2sc_vmsg(p2sc_ctx_current(), func, file, line, versionid, severity, fmt, va);
+    va_end(va);
+}
+
+void _p2sc_msg_ctx(p2sc_ctx_t *ctx, const char *func, const char *file, int line,
+                   const char *versionid, int severity, const char *fmt, ...) {
+    va_list va;
+
+    va_start(va, fmt);
+    p2sc_vmsg(ctx ? ctx : p2sc_ctx_current(), func, file, line, versionid, severity, fmt, va);
+    va_end(va);
+}
+
+static void p2sc_vmsg(p2sc_ctx_t *ctx, const char *func, const char *file, int line,
+                      const char *versionid, int severity, const char *fmt, va_list va) {
     gint len;
     char *msg, *loc, *back;
-    const char *proc_file = p2sc_get_string("filename");
+    char *proc_file = p2sc_ctx_dup_string(ctx, "filename");
 
     /* format message */
-    va_start(va, fmt);
     len = g_vasprintf(&msg, fmt, va);
-    va_end(va);
 
     if (msg[len - 1] == '\n')
         msg[len - 1] = 0;
 
     /* append to history */
-    const char *hist = p2sc_get_string("history");
-    if (hist) {
-        char *nhist = g_strdup_printf("%s|%s", hist, msg);
-
-        p2sc_set_string("history", nhist);
-        g_free(nhist);
-    } else
-        p2sc_set_string("history", msg);
+    p2sc_ctx_append_string(ctx, "history", "|", msg);
+    /* keep the reason, in case the job recovers */
+    if (severity >= LVL_FATAL)
+        p2sc_ctx_set_string(ctx, "error", msg);
 
     /* add processed file if any */
     if (proc_file) {
@@ -51,10 +65,11 @@ void _p2sc_msg(const char *func, const char *file, int line,
 
         g_free(msg);
         msg = msg2;
+        g_free(proc_file);
     }
 
     /* add location */
-    loc = g_strdup_printf("%s - %s() in %s:%d", p2sc_get_string("prgname"), func, file, line);
+    loc = g_strdup_printf("%s - %s() in %s:%d", p2sc_ctx_get_string(ctx, "prgname"), func, file, line);
     /* add backtrace */
     if (severity >= LVL_WARNING && (back = p2sc_backtrace())) {
         if (*back) {
@@ -75,12 +90,12 @@ void _p2sc_msg(const char *func, const char *file, int line,
     }
 
     /* finally send the message */
-    send2LMAT(p2sc_get_string("appname"), versionid, p2sc_get_string("runid"), msg,
+    send2LMAT(p2sc_ctx_get_string(ctx, "appname"), versionid, p2sc_ctx_get_string(ctx, "runid"), msg,
               severity, loc, NULL);
 
     /* send additional message if killed from PPT */
     if (fatal_in_ppt)
-        send2LMAT(p2sc_get_string("appname"), NULL, p2sc_get_string("runid"),
+        send2LMAT(p2sc_ctx_get_string(ctx, "appname"), NULL, p2sc_ctx_get_string(ctx, "runid"),
                   "Terminated by PPT", LVL_CONTROL_FINISH_STOP_PPT, NULL, NULL);
 
     g_free(loc);
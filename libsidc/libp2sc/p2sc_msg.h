@@ -54,11 +54,26 @@ extern "C" {
     do { \
         _p2sc_msg(__func__, __FILE__, __LINE__, _versionid_, _msgid_, __VA_ARGS__); \
         if (_msgid_ >= LVL_FATAL) \
-            exit(1); \
+            p2sc_fatal(); \
     } while (0)
 
+/* same, on an explicit job context instead of the current one */
+#define P2SC_CtxMsg(_ctx_, _msgid_, ...) \
+    do { \
+        _p2sc_msg_ctx(_ctx_, __func__, __FILE__, __LINE__, _versionid_, _msgid_, __VA_ARGS__); \
+        if (_msgid_ >= LVL_FATAL) \
+            p2sc_fatal(); \
+    } while (0)
+
+    struct p2sc_ctx_t;
+
+    /* exit(1), or unwind to the p2sc_catch() point of the calling thread */
+    void p2sc_fatal(void) __attribute__((noreturn));
+
     void _p2sc_msg(const char *, const char *, int, const char *, int,
                    const char *, ...) __attribute__((format(printf, 6, 7)));
+    void _p2sc_msg_ctx(struct p2sc_ctx_t *, const char *, const char *, int, const char *, int,
+                       const char *, ...) __attribute__((format(printf, 7, 8)));
 
 /* ---------------------------------------------------------------------- */
 
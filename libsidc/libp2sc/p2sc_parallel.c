@@ -0,0 +1,69 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <glib.h>
+
+#include "p2sc_parallel.h"
+
+/* negative for the default */
+static gint budget = -1;
+/* extra threads running, all calls together */
+static gint used;
+
+typedef struct {
+    p2sc_parallel_func_t fn;
+    void *data;
+    size_t from, to;
+    int part;
+} part_t;
+
+static gpointer part_run(gpointer data) {
+    part_t *p = (part_t *) data;
+
+    p->fn(p->from, p->to, p->part, p->data);
+    return NULL;
+}
+
+/* up to want extra threads, whatever is left of the budget */
+static int take(int want) {
+    int b = g_atomic_int_get(&budget), u, n;
+
+    if (b < 0)
+        b = g_get_num_processors() - 1;
+    do {
+        u = g_atomic_int_get(&used);
+        n = MIN(want, b - u);
+        if (n <= 0)
+            return 0;
+    } while (!g_atomic_int_compare_and_exchange(&used, u, u + n));
+
+    return n;
+}
+
+int p2sc_parallel_for(size_t n, size_t min_chunk, p2sc_parallel_func_t fn, void *data) {
+    size_t want = MIN(n / MAX(min_chunk, 1), P2SC_PARALLEL_MAX);
+    int i, extra = want > 1 ? take(want - 1) : 0, parts = extra + 1;
+    part_t part[P2SC_PARALLEL_MAX];
+    GThread *thr[P2SC_PARALLEL_MAX];
+
+    for (i = 0; i < parts; ++i)
+        part[i] = (part_t) {.fn = fn,.data = data,.from = n * i / parts,.to = n * (i + 1) / parts,.part = i };
+
+    for (i = 1; i < parts; ++i)
+        thr[i] = g_thread_new("p2sc_parallel", part_run, part + i);
+    part_run(part);
+    for (i = 1; i < parts; ++i)
+        g_thread_join(thr[i]);
+
+    if (extra)
+        g_atomic_int_add(&used, -extra);
+    return parts;
+}
+
+void p2sc_parallel_budget(int n) {
+    g_atomic_int_set(&budget, MAX(n, -1));
+}
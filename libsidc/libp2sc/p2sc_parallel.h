@@ -0,0 +1,40 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_PARALLEL_H__
+#define __P2SC_PARALLEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+/* no more parts than this per call */
+#define P2SC_PARALLEL_MAX 16
+
+    /* items [from, to) of part number part */
+    typedef void (*p2sc_parallel_func_t)(size_t from, size_t to, int part, void *data);
+
+    /*
+       n items split in consecutive parts of at least min_chunk, as many
+       as the thread budget allows, the first one in the calling thread;
+       returns once all are done with the number of parts, at least 1
+     */
+    int p2sc_parallel_for(size_t n, size_t min_chunk, p2sc_parallel_func_t, void *data);
+
+    /*
+       extra threads all the calls of the process may run at once, the
+       number of processors less one by default; 0 keeps everything in
+       the calling threads, a negative number restores the default
+     */
+    void p2sc_parallel_budget(int);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,163 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+#include "p2sc_prof.h"
+#include "p2sc_stdlib.h"
+
+typedef struct {
+    char *name;
+    guint count;
+    /* microseconds */
+    gint64 wall, cpu;
+    guint64 in, out;
+    /* kB, whole process */
+    long maxrss;
+} stage_t;
+
+struct p2sc_prof_t {
+    GMutex lock;
+    GArray *stages;
+};
+
+/* CPU time of the calling thread, encoders run in parallel */
+static gint64 thread_cpu(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static long peak_rss(void) {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru))
+        return 0;
+    return ru.ru_maxrss;
+}
+
+p2sc_prof_t *p2sc_prof_new(void) {
+    p2sc_prof_t *p = (p2sc_prof_t *) g_malloc0(sizeof *p);
+
+    g_mutex_init(&p->lock);
+    p->stages = g_array_new(FALSE, TRUE, sizeof(stage_t));
+
+    return p;
+}
+
+void p2sc_prof_free(p2sc_prof_t *p) {
+    if (p) {
+        for (guint i = 0; i < p->stages->len; ++i)
+            g_free(g_array_index(p->stages, stage_t, i).name);
+        g_array_free(p->stages, TRUE);
+        g_mutex_clear(&p->lock);
+        memset(p, 0, sizeof *p);
+        g_free(p);
+    }
+}
+
+void p2sc_prof_add(p2sc_prof_t *p, const char *name, gint64 wall, gint64 cpu,
+                   size_t in, size_t out) {
+    if (!p)
+        return;
+
+    long rss = peak_rss();
+    stage_t *s = NULL;
+
+    g_mutex_lock(&p->lock);
+    for (guint i = 0; i < p->stages->len && !s; ++i)
+        if (!strcmp(g_array_index(p->stages, stage_t, i).name, name))
+            s = &g_array_index(p->stages, stage_t, i);
+    if (!s) {
+        stage_t n = {.name = g_strdup(name) };
+        g_array_append_val(p->stages, n);
+        s = &g_array_index(p->stages, stage_t, p->stages->len - 1);
+    }
+
+    s->count++;
+    s->wall += wall, s->cpu += cpu;
+    s->in += in, s->out += out;
+    if (rss > s->maxrss)
+        s->maxrss = rss;
+    g_mutex_unlock(&p->lock);
+}
+
+void p2sc_prof_start(p2sc_mark_t *m) {
+    if (p2sc_ctx_get_prof(p2sc_ctx_current())) {
+        m->wall = g_get_monotonic_time();
+        m->cpu = thread_cpu();
+    } else
+        m->wall = m->cpu = -1;
+}
+
+void p2sc_prof_stop(const p2sc_mark_t *m, const char *name, size_t in, size_t out) {
+    p2sc_prof_t *p = p2sc_ctx_get_prof(p2sc_ctx_current());
+
+    if (p && m->wall >= 0)
+        p2sc_prof_add(p, name, g_get_monotonic_time() - m->wall, thread_cpu() - m->cpu, in, out);
+}
+
+char *p2sc_prof_text(p2sc_prof_t *p) {
+    GString *s = g_string_new(NULL);
+
+    g_mutex_lock(&p->lock);
+    for (guint i = 0; i < p->stages->len; ++i) {
+        const stage_t *t = &g_array_index(p->stages, stage_t, i);
+        g_string_append_printf(s, "  %-14s wall %9.3fms  cpu %9.3fms  in %10" G_GUINT64_FORMAT
+                               "  out %10" G_GUINT64_FORMAT "  maxrss %8ldkB\n",
+                               t->name, t->wall / 1e3, t->cpu / 1e3, t->in, t->out, t->maxrss);
+    }
+    g_mutex_unlock(&p->lock);
+
+    return g_string_free(s, FALSE);
+}
+
+static void json_string(GString *s, const char *str) {
+    g_string_append_c(s, '"');
+    for (const char *c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            g_string_append_printf(s, "\\%c", *c);
+        else if ((unsigned char) *c < 0x20)
+            g_string_append_printf(s, "\\u%04x", (unsigned char) *c);
+        else
+            g_string_append_c(s, *c);
+    }
+    g_string_append_c(s, '"');
+}
+
+char *p2sc_prof_json(p2sc_prof_t *p, const char *file, const char *error) {
+    GString *s = g_string_new("{\"file\":");
+
+    json_string(s, file);
+    g_string_append_printf(s, ",\"ok\":%s", error ? "false" : "true");
+    if (error) {
+        g_string_append(s, ",\"error\":");
+        json_string(s, error);
+    }
+
+    g_string_append(s, ",\"stages\":[");
+    g_mutex_lock(&p->lock);
+    for (guint i = 0; i < p->stages->len; ++i) {
+        const stage_t *t = &g_array_index(p->stages, stage_t, i);
+
+        g_string_append(s, i ? ",{\"name\":" : "{\"name\":");
+        json_string(s, t->name);
+        g_string_append_printf(s, ",\"count\":%u,\"wall_us\":%" G_GINT64_FORMAT
+                               ",\"cpu_us\":%" G_GINT64_FORMAT ",\"bytes_in\":%" G_GUINT64_FORMAT
+                               ",\"bytes_out\":%" G_GUINT64_FORMAT ",\"maxrss_kb\":%ld}",
+                               t->count, t->wall, t->cpu, t->in, t->out, t->maxrss);
+    }
+    g_mutex_unlock(&p->lock);
+    g_string_append(s, "]}");
+
+    return g_string_free(s, FALSE);
+}
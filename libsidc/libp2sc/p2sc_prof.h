@@ -0,0 +1,47 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_PROF_H__
+#define __P2SC_PROF_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    /*
+       per-stage wall and CPU time, bytes in and out and peak RSS of one
+       job; stages of the same name accumulate, in order of first use
+     */
+    typedef struct p2sc_prof_t p2sc_prof_t;
+
+    typedef struct {
+        gint64 wall;
+        gint64 cpu;
+    } p2sc_mark_t;
+
+    p2sc_prof_t *p2sc_prof_new(void);
+    void p2sc_prof_free(p2sc_prof_t *);
+
+    void p2sc_prof_add(p2sc_prof_t *, const char *, gint64, gint64, size_t, size_t);
+
+    /*
+       on the profile of p2sc_ctx_current(), nothing is measured when
+       it has none
+     */
+    void p2sc_prof_start(p2sc_mark_t *);
+    void p2sc_prof_stop(const p2sc_mark_t *, const char *, size_t, size_t);
+
+    /* one line per stage, or one JSON object for the file (error may be NULL) */
+    char *p2sc_prof_text(p2sc_prof_t *);
+    char *p2sc_prof_json(p2sc_prof_t *, const char *, const char *);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
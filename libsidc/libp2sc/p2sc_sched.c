@@ -0,0 +1,258 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <string.h>
+#include <glib.h>
+
+#include "p2sc_msg.h"
+#include "p2sc_sched.h"
+
+typedef struct {
+    void *job;
+    guint64 seq;
+} item_t;
+
+typedef struct stage_t stage_t;
+
+struct stage_t {
+    p2sc_sched_t *s;
+    stage_t *prev;
+    stage_t *next;
+
+    p2sc_sched_func_t work;
+    GThread **thr;
+    int nthr;
+
+    /* pending work */
+    GQueue *todo;
+    guint qmax;
+    /* items being worked on */
+    guint busy;
+};
+
+struct p2sc_sched_t {
+    GMutex lock;
+    GCond cond;
+
+    stage_t *stages;
+    int nstages;
+
+    p2sc_sched_func_t done;
+    void *data;
+
+    gboolean stop;
+
+    /* in-order completion */
+    GHashTable *finished;
+    guint64 seq_push;
+    guint64 seq_done;
+    gboolean emitting;
+
+    /* memory budget */
+    size_t budget;
+    size_t inflight;
+};
+
+/* sequence number of the job being processed by this thread */
+static GPrivate cur_seq;
+
+static void emit(p2sc_sched_t *s) {
+    item_t *it;
+
+    /* only one thread emits, done() is called without the lock */
+    if (s->emitting)
+        return;
+    s->emitting = TRUE;
+
+    while ((it = (item_t *) g_hash_table_lookup(s->finished, &s->seq_done))) {
+        g_hash_table_remove(s->finished, &s->seq_done);
+        g_mutex_unlock(&s->lock);
+        if (s->done)
+            s->done(it->job, s->data);
+        g_free(it);
+        g_mutex_lock(&s->lock);
+        ++s->seq_done;
+    }
+
+    s->emitting = FALSE;
+    g_cond_broadcast(&s->cond);
+}
+
+/* no more input can reach this stage */
+static gboolean drained(const stage_t *st) {
+    if (!st->s->stop)
+        return FALSE;
+    for (st = st->prev; st; st = st->prev)
+        if (st->busy || !g_queue_is_empty(st->todo))
+            return FALSE;
+    return TRUE;
+}
+
+static gpointer worker(gpointer data) {
+    stage_t *st = (stage_t *) data;
+    p2sc_sched_t *s = st->s;
+
+    g_mutex_lock(&s->lock);
+    for (;;) {
+        while (g_queue_is_empty(st->todo) && !drained(st))
+            g_cond_wait(&s->cond, &s->lock);
+
+        item_t *it = (item_t *) g_queue_pop_head(st->todo);
+        if (!it)
+            break;
+        ++st->busy;
+        g_cond_broadcast(&s->cond);
+        g_mutex_unlock(&s->lock);
+
+        g_private_set(&cur_seq, it);
+        st->work(it->job, s->data);
+        g_private_set(&cur_seq, NULL);
+
+        g_mutex_lock(&s->lock);
+        if (st->next) {
+            /* bounded queues throttle the faster stages */
+            while (g_queue_get_length(st->next->todo) >= st->next->qmax)
+                g_cond_wait(&s->cond, &s->lock);
+            g_queue_push_tail(st->next->todo, it);
+        } else {
+            g_hash_table_insert(s->finished, &it->seq, it);
+            emit(s);
+        }
+        --st->busy;
+        g_cond_broadcast(&s->cond);
+    }
+    g_mutex_unlock(&s->lock);
+
+    return NULL;
+}
+
+static guint seq_hash(gconstpointer v) {
+    guint64 s = *(const guint64 *) v;
+    return (guint) (s ^ (s >> 32));
+}
+
+static gboolean seq_equal(gconstpointer a, gconstpointer b) {
+    return *(const guint64 *) a == *(const guint64 *) b;
+}
+
+p2sc_sched_t *p2sc_sched_new_stages(int nstages, const p2sc_sched_stage_t *stages,
+                                    size_t budget, p2sc_sched_func_t done, void *data) {
+    if (nstages < 1)
+        P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "no stages");
+    for (int i = 0; i < nstages; ++i)
+        if (!stages[i].work)
+            P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "NULL work function for stage %d", i);
+
+    p2sc_sched_t *s = (p2sc_sched_t *) g_malloc0(sizeof *s);
+
+    g_mutex_init(&s->lock);
+    g_cond_init(&s->cond);
+
+    s->done = done;
+    s->data = data;
+
+    s->finished = g_hash_table_new(seq_hash, seq_equal);
+    s->budget = budget;
+
+    s->nstages = nstages;
+    s->stages = (stage_t *) g_malloc0(nstages * sizeof *s->stages);
+    for (int i = 0; i < nstages; ++i) {
+        stage_t *st = s->stages + i;
+
+        st->s = s;
+        st->prev = i ? st - 1 : NULL;
+        st->next = i < nstages - 1 ? st + 1 : NULL;
+
+        st->work = stages[i].work;
+        st->nthr = CLAMP(stages[i].nthr, 1, 1024);
+        st->todo = g_queue_new();
+        st->qmax = 2 * st->nthr;
+    }
+
+    /* all queues exist before any thread runs */
+    for (int i = 0; i < nstages; ++i) {
+        stage_t *st = s->stages + i;
+        const char *name = stages[i].name ? stages[i].name : "p2sc_sched";
+
+        st->thr = (GThread **) g_malloc(st->nthr * sizeof *st->thr);
+        for (int j = 0; j < st->nthr; ++j)
+            st->thr[j] = g_thread_new(name, worker, st);
+    }
+
+    return s;
+}
+
+p2sc_sched_t *p2sc_sched_new(int nthr, size_t budget, p2sc_sched_func_t work,
+                             p2sc_sched_func_t done, void *data) {
+    p2sc_sched_stage_t st = { "p2sc_sched", nthr, work };
+    return p2sc_sched_new_stages(1, &st, budget, done, data);
+}
+
+void p2sc_sched_free(p2sc_sched_t *s) {
+    if (s) {
+        g_mutex_lock(&s->lock);
+        s->stop = TRUE;
+        g_cond_broadcast(&s->cond);
+        g_mutex_unlock(&s->lock);
+
+        for (int i = 0; i < s->nstages; ++i) {
+            stage_t *st = s->stages + i;
+
+            for (int j = 0; j < st->nthr; ++j)
+                g_thread_join(st->thr[j]);
+            g_queue_free(st->todo);
+            g_free(st->thr);
+        }
+
+        if (s->seq_done != s->seq_push)
+            P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "%" G_GINT64_MODIFIER "u jobs not done",
+                     s->seq_push - s->seq_done);
+
+        g_hash_table_destroy(s->finished);
+        g_free(s->stages);
+
+        g_cond_clear(&s->cond);
+        g_mutex_clear(&s->lock);
+
+        memset(s, 0, sizeof *s);
+        g_free(s);
+    }
+}
+
+void p2sc_sched_push(p2sc_sched_t *s, void *job) {
+    item_t *it = (item_t *) g_malloc(sizeof *it);
+
+    it->job = job;
+
+    g_mutex_lock(&s->lock);
+    while (g_queue_get_length(s->stages->todo) >= s->stages->qmax)
+        g_cond_wait(&s->cond, &s->lock);
+
+    it->seq = s->seq_push++;
+    g_queue_push_tail(s->stages->todo, it);
+    g_cond_broadcast(&s->cond);
+    g_mutex_unlock(&s->lock);
+}
+
+void p2sc_sched_reserve(p2sc_sched_t *s, size_t bytes) {
+    const item_t *it = (const item_t *) g_private_get(&cur_seq);
+
+    g_mutex_lock(&s->lock);
+    /* the oldest job always proceeds, the others wait for the budget */
+    while (s->budget && s->inflight && s->inflight + bytes > s->budget &&
+           !(it && it->seq == s->seq_done))
+        g_cond_wait(&s->cond, &s->lock);
+    s->inflight += bytes;
+    g_mutex_unlock(&s->lock);
+}
+
+void p2sc_sched_release(p2sc_sched_t *s, size_t bytes) {
+    g_mutex_lock(&s->lock);
+    s->inflight -= MIN(bytes, s->inflight);
+    g_cond_broadcast(&s->cond);
+    g_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,54 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_SCHED_H__
+#define __P2SC_SCHED_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    typedef struct p2sc_sched_t p2sc_sched_t;
+    typedef void (*p2sc_sched_func_t)(void *job, void *data);
+
+    /*
+       work() runs on one of the worker threads, done() is called once per
+       job in submission order; the memory budget is shared by all the jobs
+       in flight, a budget of 0 means unlimited
+     */
+    p2sc_sched_t *p2sc_sched_new(int, size_t, p2sc_sched_func_t work, p2sc_sched_func_t done,
+                                 void *data);
+
+    /*
+       pipeline: every job goes through the stages in order, each stage has
+       its own threads and a bounded input queue, so that the stages of
+       different jobs overlap; done() is still called in submission order
+     */
+    typedef struct {
+        const char *name;
+        int nthr;
+        p2sc_sched_func_t work;
+    } p2sc_sched_stage_t;
+
+    p2sc_sched_t *p2sc_sched_new_stages(int, const p2sc_sched_stage_t *, size_t,
+                                        p2sc_sched_func_t done, void *data);
+    /* wait for all jobs to be done */
+    void p2sc_sched_free(p2sc_sched_t *);
+
+    /* blocks while the work queue is full */
+    void p2sc_sched_push(p2sc_sched_t *, void *);
+
+    /* to be called from work(), reserve blocks until the budget allows it */
+    void p2sc_sched_reserve(p2sc_sched_t *, size_t);
+    void p2sc_sched_release(p2sc_sched_t *, size_t);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
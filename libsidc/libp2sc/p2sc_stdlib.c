@@ -10,8 +10,10 @@ static const char _versionid_[] __attribute__((unused)) =
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <errno.h>
 #include <glib.h>
@@ -20,7 +22,43 @@ static const char _versionid_[] __attribute__((unused)) =
 #include "p2sc_msg.h"
 #include "p2sc_stdlib.h"
 
-static GHashTable *shash = NULL;
+typedef struct {
+    void (*func)(void *);
+    void *ptr;
+} guard_t;
+
+struct p2sc_ctx_t {
+    GHashTable *shash;
+    GMutex lock;
+
+    /* released after a recovered fatal error */
+    GSList *guards;
+    /* not owned */
+    struct p2sc_prof_t *prof;
+};
+
+static p2sc_ctx_t *dctx = NULL;
+/* context bound to the calling thread */
+static GPrivate bctx;
+/* where the calling thread recovers from fatal errors */
+static GPrivate bjmp;
+
+static p2sc_ctx_t *ctx_alloc(void) {
+    p2sc_ctx_t *c = (p2sc_ctx_t *) g_malloc0(sizeof *c);
+
+    c->shash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_mutex_init(&c->lock);
+
+    return c;
+}
+
+static void ctx_destroy(p2sc_ctx_t *c) {
+    g_slist_free_full(c->guards, g_free);
+    g_hash_table_destroy(c->shash);
+    g_mutex_clear(&c->lock);
+    memset(c, 0, sizeof *c);
+    g_free(c);
+}
 
 /* ---------------------------------------------------------------------- */
 
@@ -62,13 +100,13 @@ static void _p2sc_init_(void) {
     /* redirect GLib messages to LMAT */
     g_log_set_handler("GLib", (GLogLevelFlags) ~ 0, glib_logger, NULL);
 
-    shash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    dctx = ctx_alloc();
 }
 
 static void _p2sc_fini_(void) {
-    if (shash) {
-        g_hash_table_destroy(shash);
-        shash = NULL;
+    if (dctx) {
+        ctx_destroy(dctx);
+        dctx = NULL;
     }
 }
 
@@ -91,16 +129,178 @@ void p2sc_init(const char *prgname, const char *appname, const char *filename, c
     g_free(hist);
 }
 
+p2sc_ctx_t *p2sc_ctx_new(const char *filename) {
+    static const char *inherit[] = { "prgname", "appname", "runid", NULL };
+    p2sc_ctx_t *c = ctx_alloc();
+
+    for (const char **k = inherit; *k; ++k) {
+        char *v = p2sc_ctx_dup_string(dctx, *k);
+        if (v)
+            g_hash_table_insert(c->shash, g_strdup(*k), v);
+    }
+    if (filename)
+        p2sc_ctx_set_string(c, "filename", filename);
+
+    char *hist = g_strdup_printf("%s %s", p2sc_ctx_get_string(c, "appname"),
+                                 p2sc_ctx_get_string(c, "runid"));
+    p2sc_ctx_set_string(c, "history", hist);
+    g_free(hist);
+
+    return c;
+}
+
+void p2sc_ctx_free(p2sc_ctx_t *c) {
+    if (c && c != dctx) {
+        if (g_private_get(&bctx) == c)
+            g_private_set(&bctx, NULL);
+        ctx_destroy(c);
+    }
+}
+
+p2sc_ctx_t *p2sc_ctx_default(void) {
+    return dctx;
+}
+
+p2sc_ctx_t *p2sc_ctx_current(void) {
+    p2sc_ctx_t *c = (p2sc_ctx_t *) g_private_get(&bctx);
+    return c ? c : dctx;
+}
+
+p2sc_ctx_t *p2sc_ctx_bind(p2sc_ctx_t *c) {
+    p2sc_ctx_t *old = (p2sc_ctx_t *) g_private_get(&bctx);
+
+    g_private_set(&bctx, c == dctx ? NULL : c);
+    return old;
+}
+
+void p2sc_ctx_set_string(p2sc_ctx_t *c, const char *key, const char *value) {
+    if (c) {
+        g_mutex_lock(&c->lock);
+        g_hash_table_insert(c->shash, g_strdup(key), g_strdup(value));
+        g_mutex_unlock(&c->lock);
+    }
+}
+
+/* the lock does not cover the caller's use of the value: write-once keys only */
+const char *p2sc_ctx_get_string(p2sc_ctx_t *c, const char *key) {
+    const char *ret = NULL;
+
+    if (c) {
+        g_mutex_lock(&c->lock);
+        ret = (const char *) g_hash_table_lookup(c->shash, key);
+        g_mutex_unlock(&c->lock);
+    }
+    return ret;
+}
+
+char *p2sc_ctx_dup_string(p2sc_ctx_t *c, const char *key) {
+    char *ret = NULL;
+
+    if (c) {
+        g_mutex_lock(&c->lock);
+        ret = g_strdup((const char *) g_hash_table_lookup(c->shash, key));
+        g_mutex_unlock(&c->lock);
+    }
+    return ret;
+}
+
+void p2sc_ctx_append_string(p2sc_ctx_t *c, const char *key, const char *sep, const char *value) {
+    if (c) {
+        g_mutex_lock(&c->lock);
+        const char *old = (const char *) g_hash_table_lookup(c->shash, key);
+        char *nval = old ? g_strconcat(old, sep, value, NULL) : g_strdup(value);
+        g_hash_table_insert(c->shash, g_strdup(key), nval);
+        g_mutex_unlock(&c->lock);
+    }
+}
+
+void p2sc_ctx_set_prof(p2sc_ctx_t *c, struct p2sc_prof_t *prof) {
+    if (c)
+        c->prof = prof;
+}
+
+struct p2sc_prof_t *p2sc_ctx_get_prof(p2sc_ctx_t *c) {
+    return c ? c->prof : NULL;
+}
+
+void p2sc_catch(jmp_buf *jb) {
+    g_private_set(&bjmp, jb);
+}
+
+void p2sc_ctx_guard(p2sc_ctx_t *c, void (*func)(void *), void *ptr) {
+    if (c && ptr) {
+        guard_t *g = (guard_t *) g_malloc(sizeof *g);
+
+        g->func = func, g->ptr = ptr;
+        g_mutex_lock(&c->lock);
+        c->guards = g_slist_prepend(c->guards, g);
+        g_mutex_unlock(&c->lock);
+    }
+}
+
+void p2sc_ctx_unguard(p2sc_ctx_t *c, void *ptr) {
+    if (c && ptr) {
+        g_mutex_lock(&c->lock);
+        for (GSList *l = c->guards; l; l = l->next) {
+            guard_t *g = (guard_t *) l->data;
+            if (g->ptr == ptr) {
+                c->guards = g_slist_delete_link(c->guards, l);
+                g_free(g);
+                break;
+            }
+        }
+        g_mutex_unlock(&c->lock);
+    }
+}
+
+void p2sc_ctx_cleanup(p2sc_ctx_t *c) {
+    if (!c)
+        return;
+
+    /* newest first; a guard may unguard others */
+    for (;;) {
+        guard_t *g = NULL;
+
+        g_mutex_lock(&c->lock);
+        if (c->guards) {
+            g = (guard_t *) c->guards->data;
+            c->guards = g_slist_delete_link(c->guards, c->guards);
+        }
+        g_mutex_unlock(&c->lock);
+
+        if (!g)
+            break;
+        g->func(g->ptr);
+        g_free(g);
+    }
+}
+
+void p2sc_fatal(void) {
+    jmp_buf *jb = (jmp_buf *) g_private_get(&bjmp);
+
+    if (jb) {
+        /* once */
+        g_private_set(&bjmp, NULL);
+        longjmp(*jb, 1);
+    }
+    exit(1);
+}
+
+/* the historical API works on the context of the calling thread */
 void p2sc_set_string(const char *key, const char *value) {
-    if (shash)
-        g_hash_table_insert(shash, g_strdup(key), g_strdup(value));
+    p2sc_ctx_set_string(p2sc_ctx_current(), key, value);
 }
 
 const char *p2sc_get_string(const char *key) {
-    if (shash)
-        return (const char *) g_hash_table_lookup(shash, key);
-    else
-        return NULL;
+    return p2sc_ctx_get_string(p2sc_ctx_current(), key);
+}
+
+char *p2sc_dup_string(const char *key) {
+    return p2sc_ctx_dup_string(p2sc_ctx_current(), key);
+}
+
+void p2sc_append_string(const char *key, const char *sep, const char *value) {
+    p2sc_ctx_append_string(p2sc_ctx_current(), key, sep, value);
 }
 
 void p2sc_option_ext(int marg, int *argc, char ***argv, const char *appname,
@@ -14,6 +14,8 @@ extern "C" {
 
 /* ---------------------------------------------------------------------- */
 
+#include <setjmp.h>
+
 #define PPT_LIBNAME "libppt"
 
 #define P_GUINT64_FHEX "%016"G_GINT64_MODIFIER"x"
@@ -22,6 +24,46 @@ extern "C" {
 
     void p2sc_init(const char *, const char *, const char *, const char *);
 
+    /*
+       per-job string table: a new context inherits prgname/appname/runid
+       from the default one; the context bound to a thread is used by the
+       calling thread instead of the default one
+     */
+    typedef struct p2sc_ctx_t p2sc_ctx_t;
+
+    p2sc_ctx_t *p2sc_ctx_new(const char *);
+    void p2sc_ctx_free(p2sc_ctx_t *);
+
+    p2sc_ctx_t *p2sc_ctx_default(void);
+    p2sc_ctx_t *p2sc_ctx_current(void);
+    p2sc_ctx_t *p2sc_ctx_bind(p2sc_ctx_t *);
+
+    void p2sc_ctx_set_string(p2sc_ctx_t *, const char *, const char *);
+    /*
+       borrowed, only for the keys set once before the context is shared
+       (prgname, appname, runid); a set or append by another thread frees
+       it, use p2sc_ctx_dup_string() for the others
+     */
+    const char *p2sc_ctx_get_string(p2sc_ctx_t *, const char *);
+    char *p2sc_ctx_dup_string(p2sc_ctx_t *, const char *);
+    void p2sc_ctx_append_string(p2sc_ctx_t *, const char *, const char *, const char *);
+
+    /* stage timings of the job, see p2sc_prof.h; NULL when not profiling */
+    struct p2sc_prof_t;
+    void p2sc_ctx_set_prof(p2sc_ctx_t *, struct p2sc_prof_t *);
+    struct p2sc_prof_t *p2sc_ctx_get_prof(p2sc_ctx_t *);
+
+    /*
+       recoverable fatal errors: with a jmp_buf armed by the calling thread,
+       a LVL_FATAL message stores its text as "error" in the context and
+       longjmps there (once) instead of exit(1); the guards of the context
+       are run by p2sc_ctx_cleanup()
+     */
+    void p2sc_catch(jmp_buf *);
+    void p2sc_ctx_guard(p2sc_ctx_t *, void (*)(void *), void *);
+    void p2sc_ctx_unguard(p2sc_ctx_t *, void *);
+    void p2sc_ctx_cleanup(p2sc_ctx_t *);
+
     /*
        generic
        "filename"
@@ -33,8 +75,12 @@ extern "C" {
        SW-TMR
        "jpeg_info"
      */
+    /* on p2sc_ctx_current() */
     void p2sc_set_string(const char *, const char *);
+    /* borrowed, the same restriction as p2sc_ctx_get_string() */
     const char *p2sc_get_string(const char *);
+    char *p2sc_dup_string(const char *);
+    void p2sc_append_string(const char *, const char *, const char *);
 
     void p2sc_option_ext(int, int *, char ***, const char *, const char *,
                          const char *, const GOptionEntry *);
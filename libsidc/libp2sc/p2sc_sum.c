@@ -0,0 +1,176 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <string.h>
+#include <glib.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "p2sc_parallel.h"
+#include "p2sc_sum.h"
+
+/* no 32-bit lane overflows within 65535 additions of 16-bit halves */
+#define LANE_MAX   65535
+
+/* the multithreaded sum works on blocks of whole words, 4 MB per part at least */
+#define SUM_BLOCK  64
+#define SUM_MT_MIN ((4 << 20) / SUM_BLOCK)
+
+typedef void (*words_func_t)(const guint8 *, size_t, guint64 *, guint64 *);
+
+/* n is a multiple of 4, the halves of each word are accumulated apart */
+static void words_scalar(const guint8 *p, size_t n, guint64 *hi, guint64 *lo) {
+    guint64 h = 0, l = 0;
+
+    for (size_t i = 0; i < n; i += 4) {
+        h += (guint32) p[i] << 8 | p[i + 1];
+        l += (guint32) p[i + 2] << 8 | p[i + 3];
+    }
+    *hi += h, *lo += l;
+}
+
+#if defined(__x86_64__)
+/*
+   byte-swapped 16-bit lanes: the low half of each little-endian 32-bit
+   lane is then the high half of the big-endian word
+ */
+static void words_sse2(const guint8 *p, size_t n, guint64 *hi, guint64 *lo) {
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        size_t end = i + MIN((n - i) & ~(size_t) 15, (size_t) LANE_MAX * 16);
+        __m128i h = _mm_setzero_si128(), l = _mm_setzero_si128();
+
+        for (; i < end; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            h = _mm_add_epi32(h, _mm_and_si128(v, mask));
+            l = _mm_add_epi32(l, _mm_srli_epi32(v, 16));
+        }
+
+        guint32 a[4], b[4];
+        _mm_storeu_si128((__m128i *) a, h);
+        _mm_storeu_si128((__m128i *) b, l);
+        for (int k = 0; k < 4; ++k)
+            *hi += a[k], *lo += b[k];
+    }
+    words_scalar(p + i, n - i, hi, lo);
+}
+
+__attribute__((target("avx2")))
+static void words_avx2(const guint8 *p, size_t n, guint64 *hi, guint64 *lo) {
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    size_t i = 0;
+
+    while (n - i >= 32) {
+        size_t end = i + MIN((n - i) & ~(size_t) 31, (size_t) LANE_MAX * 32);
+        __m256i h = _mm256_setzero_si256(), l = _mm256_setzero_si256();
+
+        for (; i < end; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+            h = _mm256_add_epi32(h, _mm256_and_si256(v, mask));
+            l = _mm256_add_epi32(l, _mm256_srli_epi32(v, 16));
+        }
+
+        guint32 a[8], b[8];
+        _mm256_storeu_si256((__m256i *) a, h);
+        _mm256_storeu_si256((__m256i *) b, l);
+        for (int k = 0; k < 8; ++k)
+            *hi += a[k], *lo += b[k];
+    }
+    words_sse2(p + i, n - i, hi, lo);
+}
+#endif
+
+static words_func_t words_kernel(const char **name) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return words_avx2;
+    }
+    *name = "sse2";
+    return words_sse2;
+#else
+    *name = "scalar";
+    return words_scalar;
+#endif
+}
+
+/* end-around carries between the halves */
+static guint32 fold(guint64 hi, guint64 lo) {
+    while ((hi >> 16) || (lo >> 16)) {
+        guint64 hc = hi >> 16, lc = lo >> 16;
+
+        hi = (hi & 0xffff) + lc;
+        lo = (lo & 0xffff) + hc;
+    }
+    return (guint32) (hi << 16 | lo);
+}
+
+static guint32 fits_sum(words_func_t words, const void *buf, size_t len, guint32 sum) {
+    const guint8 *p = (const guint8 *) buf;
+    guint64 hi = sum >> 16, lo = sum & 0xffff;
+    size_t n = len & ~(size_t) 3;
+
+    words(p, n, &hi, &lo);
+    if (n < len) {
+        guint8 w[4] = { 0, 0, 0, 0 };
+
+        memcpy(w, p + n, len - n);
+        words_scalar(w, 4, &hi, &lo);
+    }
+    return fold(hi, lo);
+}
+
+guint32 p2sc_fits_sum(const void *buf, size_t len, guint32 sum) {
+    const char *name;
+    return fits_sum(words_kernel(&name), buf, len, sum);
+}
+
+guint32 p2sc_fits_sum_scalar(const void *buf, size_t len, guint32 sum) {
+    return fits_sum(words_scalar, buf, len, sum);
+}
+
+guint32 p2sc_fits_sum_add(guint32 a, guint32 b) {
+    return fold((a >> 16) + (b >> 16), (a & 0xffff) + (b & 0xffff));
+}
+
+const char *p2sc_fits_sum_kernel(void) {
+    const char *name;
+    words_kernel(&name);
+    return name;
+}
+
+typedef struct {
+    const guint8 *p;
+    size_t len;
+    guint32 sum[P2SC_PARALLEL_MAX];
+} sums_t;
+
+static void sum_part(size_t from, size_t to, int part, void *data) {
+    sums_t *t = (sums_t *) data;
+    size_t a = from * SUM_BLOCK, b = MIN(to * SUM_BLOCK, t->len);
+
+    t->sum[part] = p2sc_fits_sum(t->p + a, b - a, 0);
+}
+
+guint32 p2sc_fits_sum_mt(const void *buf, size_t len, guint32 sum) {
+    sums_t t = {.p = (const guint8 *) buf,.len = len };
+
+    /* the partial sums of whole words add up in any order */
+    int i, n = p2sc_parallel_for((len + SUM_BLOCK - 1) / SUM_BLOCK, SUM_MT_MIN, sum_part, &t);
+    for (i = 0; i < n; ++i)
+        sum = p2sc_fits_sum_add(sum, t.sum[i]);
+
+    return sum;
+}
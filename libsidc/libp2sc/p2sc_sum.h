@@ -0,0 +1,36 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_SUM_H__
+#define __P2SC_SUM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    /*
+       FITS 32-bit 1's complement checksum of big-endian words, continued
+       from sum; a trailing partial word is padded with zeros
+     */
+    guint32 p2sc_fits_sum(const void *, size_t, guint32);
+    /* the same, large buffers are split across threads */
+    guint32 p2sc_fits_sum_mt(const void *, size_t, guint32);
+    /* the plain C kernel, for comparison */
+    guint32 p2sc_fits_sum_scalar(const void *, size_t, guint32);
+
+    /* combined sum of two consecutive parts, the order does not matter */
+    guint32 p2sc_fits_sum_add(guint32, guint32);
+
+    /* name of the kernel selected for this CPU */
+    const char *p2sc_fits_sum_kernel(void);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,129 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "p2sc_msg.h"
+#include "p2sc_watch.h"
+
+struct p2sc_watch_t {
+    char *dir;
+    int fd;
+    int wd;
+    /* names read but not yet returned */
+    GQueue *pending;
+    /* events were lost since the last p2sc_watch_overflow() */
+    int overflow;
+};
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+p2sc_watch_t *p2sc_watch_new(const char *dir) {
+    p2sc_watch_t *w = (p2sc_watch_t *) g_malloc0(sizeof *w);
+
+    w->dir = g_strdup(dir);
+    w->pending = g_queue_new();
+
+    if ((w->fd = inotify_init1(IN_CLOEXEC)) < 0)
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "inotify_init1(): %s", g_strerror(errno));
+    if ((w->wd = inotify_add_watch(w->fd, dir, WATCH_MASK | IN_ONLYDIR)) < 0)
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "%s: %s", dir, g_strerror(errno));
+
+    return w;
+}
+
+void p2sc_watch_free(p2sc_watch_t *w) {
+    if (w) {
+        close(w->fd);
+        g_queue_free_full(w->pending, g_free);
+        g_free(w->dir);
+        memset(w, 0, sizeof *w);
+        g_free(w);
+    }
+}
+
+static int watch_read(p2sc_watch_t *w, int timeout) {
+    struct pollfd pfd = {.fd = w->fd,.events = POLLIN };
+
+    int ret = poll(&pfd, 1, timeout);
+    if (ret < 0) {
+        if (errno == EINTR)
+            return 0;
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "poll(): %s", g_strerror(errno));
+    }
+    if (ret == 0)
+        return 0;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(w->fd, buf, sizeof buf);
+    if (len < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 0;
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "read(inotify): %s", g_strerror(errno));
+    }
+
+    for (char *p = buf; p < buf + len;) {
+        const struct inotify_event *e = (const struct inotify_event *) p;
+
+        if (e->mask & IN_Q_OVERFLOW) {
+            P2SC_Msg(LVL_WARNING_FILESYSTEM, "%s: inotify queue overflow, events lost", w->dir);
+            w->overflow = 1;
+        }
+        if (e->mask & (IN_IGNORED | IN_DELETE_SELF | IN_UNMOUNT))
+            P2SC_Msg(LVL_FATAL_FILESYSTEM, "%s: watched directory is gone", w->dir);
+
+        if ((e->mask & WATCH_MASK) && e->len && !(e->mask & IN_ISDIR))
+            g_queue_push_tail(w->pending, g_build_filename(w->dir, e->name, NULL));
+
+        p += sizeof *e + e->len;
+    }
+
+    return 1;
+}
+
+char *p2sc_watch_next(p2sc_watch_t *w, int timeout) {
+    if (g_queue_is_empty(w->pending))
+        watch_read(w, timeout);
+
+    return (char *) g_queue_pop_head(w->pending);
+}
+
+int p2sc_watch_overflow(p2sc_watch_t *w) {
+    int ret = w->overflow;
+
+    w->overflow = 0;
+    return ret;
+}
+
+#else
+
+p2sc_watch_t *p2sc_watch_new(const char *dir) {
+    P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "%s: directory watching not supported", dir);
+}
+
+void p2sc_watch_free(p2sc_watch_t *w G_GNUC_UNUSED) {
+}
+
+char *p2sc_watch_next(p2sc_watch_t *w G_GNUC_UNUSED, int timeout G_GNUC_UNUSED) {
+    return NULL;
+}
+
+int p2sc_watch_overflow(p2sc_watch_t *w G_GNUC_UNUSED) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __P2SC_WATCH_H__
+#define __P2SC_WATCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    typedef struct p2sc_watch_t p2sc_watch_t;
+
+    /* files appearing in a directory: closed after writing or renamed into it */
+    p2sc_watch_t *p2sc_watch_new(const char *);
+    void p2sc_watch_free(p2sc_watch_t *);
+
+    /*
+       full path of the next file, NULL after timeout milliseconds
+       (negative waits forever) or when interrupted by a signal
+     */
+    char *p2sc_watch_next(p2sc_watch_t *, int);
+    /* nonzero, once, after the kernel dropped events: the directory is to be rescanned */
+    int p2sc_watch_overflow(p2sc_watch_t *);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
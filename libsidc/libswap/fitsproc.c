@@ -9,23 +9,72 @@ static const char _versionid_[] __attribute__((unused)) =
     "$Id: fitsproc.c 4468 2015-04-30 12:51:27Z bogdan $";
 
 #include <string.h>
+#include <sys/stat.h>
 #include <glib.h>
 
 #include "p2sc_fits.h"
+#include "p2sc_msg.h"
+#include "p2sc_prof.h"
+#include "p2sc_stdlib.h"
 #include "swap_meta.h"
 
 #include "fitsproc.h"
 
-static char *process_header(sfts_t *, const char *);
+static char *process_header(sfts_t *, const char *, const procfits_t *);
+static procfits_t *procfits_new(sfts_t *, const char *, const char *,
+                                const char *, const char *, const char *,
+                                const char *, const char *);
 
-procfits_t *fitsproc(const char *name, const char *contact, int noverify,
-                     const char *dateobs, const char *telescop, const char *instrume,
-                     const char *detector, const char *wavelnth) {
-    sfts_t *f = sfts_openro(name, noverify ? SFTS_SUM_NOVERIFY : 0);
+/* the still open file is guarded on its own */
+static void procfits_abort(void *ptr) {
+    procfits_t *p = (procfits_t *) ptr;
+
+    p->fts = NULL;
+    procfits_free(p);
+}
+
+procfits_t *fitsproc_header(const char *name, const char *contact, int noverify,
+                            const char *dateobs, const char *telescop, const char *instrume,
+                            const char *detector, const char *wavelnth) {
+    struct stat st;
+    p2sc_mark_t m;
+
+    /* checksums are verified while the image is read */
+    p2sc_prof_start(&m);
+    sfts_t *f = sfts_openro(name, noverify ? SFTS_SUM_NOVERIFY : SFTS_SUM_DEFER);
+    p2sc_prof_stop(&m, "open", stat(name, &st) ? 0 : (size_t) st.st_size, 0);
+
+    return procfits_new(f, name, contact, dateobs, telescop, instrume, detector, wavelnth);
+}
+
+procfits_t *fitsproc_metadata(const char *name, const char *contact,
+                              const char *dateobs, const char *telescop, const char *instrume,
+                              const char *detector, const char *wavelnth) {
+    p2sc_mark_t m;
+
+    p2sc_prof_start(&m);
+    sfts_t *f = sfts_openhdr(name, "DATE-OBS");
+    p2sc_prof_stop(&m, "open", 0, 0);
+
+    procfits_t *p = procfits_new(f, name, contact, dateobs, telescop, instrume, detector, wavelnth);
+
+    g_free(sfts_free(p->fts));
+    p->fts = NULL;
+    return p;
+}
 
+static procfits_t *procfits_new(sfts_t *f, const char *name, const char *contact,
+                                const char *dateobs, const char *telescop, const char *instrume,
+                                const char *detector, const char *wavelnth) {
+    p2sc_mark_t m;
+
+    p2sc_prof_start(&m);
     sfts_find_hdukey(f, "DATE-OBS");
 
     procfits_t *p = (procfits_t *) g_malloc0(sizeof *p);
+    p->ctx = sfts_get_ctx(f);
+    p2sc_ctx_guard(p->ctx, procfits_abort, p);
+
     p->name = g_strdup(name);
     p->dateobs = dateobs ? g_strdup(dateobs) : sfts_read_keystring(f, "DATE-OBS");
 
@@ -49,23 +98,108 @@ procfits_t *fitsproc(const char *name, const char *contact, int noverify,
 
     p->wavelnth = wavelnth ? g_strdup(wavelnth) : sfts_read_keystring(f, "WAVELNTH");
 
-    p->xml = process_header(f, contact);
-    p->im = (float *) sfts_read_image(f, &(p->w), &(p->h), SFLOAT);
+    p->datasum = sfts_read_keystring0(f, "DATASUM");
+    p->checksum = sfts_read_keystring0(f, "CHECKSUM");
+
+    p->xml = process_header(f, contact, NULL);
+    sfts_get_image_size(f, &(p->w), &(p->h));
+    p->type = sfts_get_image_type(f, &(p->bscale), &(p->bzero));
+    p2sc_prof_stop(&m, "header", 0, p->xml ? strlen(p->xml) : 0);
+
+    p->fts = f;
+    return p;
+}
+
+void fitsproc_image(procfits_t *p) {
+    if (!p->fts)
+        return;
+
+    p2sc_mark_t m;
+
+    p2sc_prof_start(&m);
+    if (p->step)
+        p->im = (float *) sfts_read_region(p->fts, p->rx, p->ry, p->rw, p->rh, p->step,
+                                           &(p->w), &(p->h), SFLOAT);
+    else
+        p->im = (float *) sfts_read_image(p->fts, &(p->w), &(p->h), SFLOAT);
+    p2sc_prof_stop(&m, "read", 0, p->w * p->h * sizeof(float));
+
+    g_free(sfts_free(p->fts));
+    p->fts = NULL;
+}
+
+void fitsproc_image_raw(procfits_t *p) {
+    if (!p->fts)
+        return;
+    if (p->type != SINT16) {
+        fitsproc_image(p);
+        return;
+    }
+
+    p2sc_mark_t m;
+
+    /* uncompressed: no copy at all, the file stays open for the view */
+    p2sc_prof_start(&m);
+    if (!p->step)
+        p->view = (const gint16 *) sfts_map_image(p->fts, &(p->w), &(p->h), SINT16 | SRAW);
+    if (p->view) {
+        p2sc_prof_stop(&m, "map", 0, p->w * p->h * sizeof(gint16));
+        return;
+    }
+
+    p2sc_prof_start(&m);
+    if (p->step)
+        p->raw = (gint16 *) sfts_read_region(p->fts, p->rx, p->ry, p->rw, p->rh, p->step,
+                                             &(p->w), &(p->h), SINT16 | SRAW);
+    else
+        p->raw = (gint16 *) sfts_read_image(p->fts, &(p->w), &(p->h), SINT16 | SRAW);
+    p2sc_prof_stop(&m, "read", 0, p->w * p->h * sizeof(gint16));
+
+    g_free(sfts_free(p->fts));
+    p->fts = NULL;
+}
 
-    g_free(sfts_free(f));
+void fitsproc_set_region(procfits_t *p, const char *contact,
+                         size_t x, size_t y, size_t w, size_t h, size_t step) {
+    if (!p->fts)
+        return;
+    if (!step || x >= p->w || y >= p->h || !w || !h)
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "region %zu,%zu,%zu,%zu/%zu outside %zux%zu",
+                 x, y, w, h, step, p->w, p->h);
+
+    p->rx = x, p->ry = y, p->step = step;
+    p->rw = MIN(w, p->w - x), p->rh = MIN(h, p->h - y);
+    p->w = (p->rw + step - 1) / step, p->h = (p->rh + step - 1) / step;
+
+    g_free(p->xml);
+    p->xml = process_header(p->fts, contact, p);
+}
+
+procfits_t *fitsproc(const char *name, const char *contact, int noverify,
+                     const char *dateobs, const char *telescop, const char *instrume,
+                     const char *detector, const char *wavelnth) {
+    procfits_t *p = fitsproc_header(name, contact, noverify,
+                                    dateobs, telescop, instrume, detector, wavelnth);
+    fitsproc_image(p);
 
     return p;
 }
 
 void procfits_free(procfits_t *p) {
     if (p) {
+        p2sc_ctx_unguard(p->ctx, p);
+        if (p->fts)
+            g_free(sfts_free(p->fts));
         g_free(p->im);
+        g_free(p->raw);
         g_free(p->name);
         g_free(p->dateobs);
         g_free(p->telescop);
         g_free(p->instrume);
         g_free(p->detector);
         g_free(p->wavelnth);
+        g_free(p->datasum);
+        g_free(p->checksum);
         g_free(p->xml);
 
         memset(p, 0, sizeof *p);
@@ -73,9 +207,43 @@ void procfits_free(procfits_t *p) {
     }
 }
 
-static char *process_header(sfts_t *f, const char *contact) {
+/* the WCS of the region, CRPIXn as the FITS pixels of the result counted from the bottom */
+static void region_wcs(sfts_t *f, sfts_t *f2, const procfits_t *r, size_t ih) {
+    double org[] = { r->rx + 1., ih - r->ry - (r->h - 1.) * r->step };
+    char key[SKEY_LEN];
+    sfkey_t k = {.c = NULL };
+
+    k.k = "NAXIS1", k.t = 'I', k.v.i = r->w;
+    sfts_write_key(f2, &k);
+    k.k = "NAXIS2", k.t = 'I', k.v.i = r->h;
+    sfts_write_key(f2, &k);
+
+    k.k = key;
+
+    for (int i = 1; i <= 2; ++i) {
+        g_snprintf(key, sizeof key, "CRPIX%d", i), k.t = 'F';
+        if (sfts_read_keymaybe(f, &k) == 1) {
+            k.v.f = (k.v.f - org[i - 1]) / r->step + 1;
+            sfts_write_key(f2, &k);
+        }
+        g_snprintf(key, sizeof key, "CDELT%d", i), k.t = 'F';
+        if (sfts_read_keymaybe(f, &k) == 1) {
+            k.v.f *= r->step;
+            sfts_write_key(f2, &k);
+        }
+        for (int j = 1; j <= 2; ++j) {
+            g_snprintf(key, sizeof key, "CD%d_%d", i, j), k.t = 'F';
+            if (sfts_read_keymaybe(f, &k) == 1) {
+                k.v.f *= r->step;
+                sfts_write_key(f2, &k);
+            }
+        }
+    }
+}
+
+static char *process_header(sfts_t *f, const char *contact, const procfits_t *r) {
     int z1 = -1, z2 = -1;
-    int naxis1, naxis2, znaxis1, znaxis2;
+    int naxis1, naxis2, znaxis1 = 0, znaxis2 = 0;
     sfkey_t k = {.c = NULL };
 
     k.k = "ZNAXIS1", k.t = 'I', z1 = sfts_read_keymaybe(f, &k);
@@ -91,21 +259,31 @@ static char *process_header(sfts_t *f, const char *contact) {
         k.k = "NAXIS2", k.t = 'I', sfts_read_key(f, &k);
         naxis2 = k.v.i;
 
-        if (naxis1 != znaxis1 || naxis2 != znaxis2) {
-            sfts_t *f2 = sfts_create(NULL, NULL);
+        if (naxis1 == znaxis1 && naxis2 == znaxis2)
+            z1 = z2 = 0;
+    }
+    if ((z1 != 1 || z2 != 1) && !r)
+        return swap_fits2hv(f, contact);
 
-            sfts_copy_header(f, f2);
-            k.k = "NAXIS1", k.t = 'I', k.v.i = znaxis1;
-            sfts_write_key(f2, &k);
-            k.k = "NAXIS2", k.t = 'I', k.v.i = znaxis2;
-            sfts_write_key(f2, &k);
+    sfts_t *f2 = sfts_create(NULL, NULL);
+    sfts_set_ctx(f2, sfts_get_ctx(f));
 
-            char *ret = swap_fits2hv(f2, contact);
-            g_free(sfts_free(f2));
+    sfts_copy_header(f, f2);
+    if (z1 == 1 && z2 == 1) {
+        k.k = "NAXIS1", k.t = 'I', k.v.i = znaxis1;
+        sfts_write_key(f2, &k);
+        k.k = "NAXIS2", k.t = 'I', k.v.i = znaxis2;
+        sfts_write_key(f2, &k);
+    }
+    if (r) {
+        size_t iw, ih;
 
-            return ret;
-        }
+        sfts_get_image_size(f, &iw, &ih);
+        region_wcs(f, f2, r, ih);
     }
 
-    return swap_fits2hv(f, contact);
+    char *ret = swap_fits2hv(f2, contact);
+    g_free(sfts_free(f2));
+
+    return ret;
 }
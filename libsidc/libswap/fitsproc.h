@@ -23,16 +23,53 @@ extern "C" {
         char *detector;
         char *wavelnth;
 
+        /* identify the data of the input, NULL when missing */
+        char *datasum;
+        char *checksum;
+
         float *im;
         size_t w;
         size_t h;
 
+        /* stored pixel type; 16-bit counts read by fitsproc_image_raw() */
+        int type;
+        double bscale;
+        double bzero;
+        gint16 *raw;
+        /* or a view of the file: big-endian, bottom row first, valid while fts is open */
+        const gint16 *view;
+
+        /* region read instead of the whole image, see fitsproc_set_region() */
+        size_t rx, ry, rw, rh, step;
+
         char *xml;
+
+        /* open between fitsproc_header() and fitsproc_image() */
+        struct sfts_t *fts;
+        /* job context the result is guarded in */
+        struct p2sc_ctx_t *ctx;
     } procfits_t;
 
     procfits_t *fitsproc(const char *, const char *, int,
                          const char *dateobs, const char *telescop, const char *instrume,
                          const char *detector, const char *wavelnth);
+
+    /* two steps: metadata and image size first, then the image data */
+    procfits_t *fitsproc_header(const char *, const char *, int,
+                                const char *dateobs, const char *telescop, const char *instrume,
+                                const char *detector, const char *wavelnth);
+    /* the same fields and XML from the headers only, the data units are not read */
+    procfits_t *fitsproc_metadata(const char *, const char *,
+                                  const char *dateobs, const char *telescop, const char *instrume,
+                                  const char *detector, const char *wavelnth);
+    void fitsproc_image(procfits_t *);
+    /* view or raw instead of im for 16-bit integer images, im otherwise */
+    void fitsproc_image_raw(procfits_t *);
+    /*
+       between the two steps: only x, y, w, h from the top left, every
+       step-th pixel; w, h and the WCS of the XML become those of the result
+     */
+    void fitsproc_set_region(procfits_t *, const char *, size_t, size_t, size_t, size_t, size_t);
     void procfits_free(procfits_t *);
 
 /* ---------------------------------------------------------------------- */
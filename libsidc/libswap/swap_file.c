@@ -16,6 +16,7 @@ static const char _versionid_[] __attribute__((unused)) =
 #include <jpeglib.h>
 #include <glib.h>
 
+#include "p2sc_buffer.h"
 #include "p2sc_file.h"
 #include "p2sc_msg.h"
 #include "p2sc_stdlib.h"
@@ -24,22 +25,29 @@ static const char _versionid_[] __attribute__((unused)) =
 #include "swap_color.h"
 #include "swap_file.h"
 
+#define PNG_ERRLEN 256
+
+void swap_write_file(const char *name, const guint8 *buf, size_t len) {
+    p2sc_create_file(1, name, buf, len);
+}
+
 static void png_warning_fn(png_structp png_ptr G_GNUC_UNUSED, png_const_charp msg) {
     P2SC_Msg(LVL_WARNING_CORRUPT_INPUT_DATA, "libpng: %s", msg);
 }
 
+/* reported by the writer once libpng state is released */
 static void png_error_fn(png_structp png_ptr, png_const_charp msg) {
-    /* fatal, subsequent code will not be executed */
-    P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "libpng: %s", msg);
+    char *err = (char *) png_get_error_ptr(png_ptr);
+
+    g_strlcpy(err, msg, PNG_ERRLEN);
     longjmp(png_jmpbuf(png_ptr), 1);
 }
 
 static void png_write_fn(png_structp png_ptr, png_bytep data, png_size_t length) {
-    p2sc_write((p2sc_iofile_t *) png_get_io_ptr(png_ptr), (const char *) data, length);
+    p2sc_buffer_write((p2sc_buffer_t *) png_get_io_ptr(png_ptr), length, data);
 }
 
-static void png_flush_fn(png_structp png_ptr) {
-    p2sc_flush((p2sc_iofile_t *) png_get_io_ptr(png_ptr));
+static void png_flush_fn(png_structp png_ptr G_GNUC_UNUSED) {
 }
 
 static void set_text(png_text *txt, const char *key, const char *value) {
@@ -59,12 +67,12 @@ static void set_meta(png_structp png_ptr, png_infop info_ptr, const char *xml) {
 #define GRAY_ICC sidc_gray_icc
 #define SRGB_ICC sRGB_IEC61966_2_1_black_scaled_icc
 
-void swap_write_png(const char *name, const guint8 *in, size_t w, size_t h,
-                    swap_palette_t *pal, const char *xml, int strategy) {
-    const guint8 **rows = NULL;
-    p2sc_iofile_t *io = p2sc_open_iofile(name, "w");
+guint8 *swap_encode_png(const guint8 *in, size_t w, size_t h,
+                        swap_palette_t *pal, const char *xml, int strategy, size_t *len) {
+    const guint8 **volatile rows = NULL;
+    char err[PNG_ERRLEN] = "";
 
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, png_error_fn,
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, err, png_error_fn,
                                                   png_warning_fn);
     if (!png_ptr)
         P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "PNG initialization error");
@@ -74,6 +82,8 @@ void swap_write_png(const char *name, const guint8 *in, size_t w, size_t h,
         P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "PNG initialization error");
     }
 
+    p2sc_buffer_t *b = p2sc_buffer_new(NULL, 0);
+
     if (setjmp(png_jmpbuf(png_ptr)))
         goto end;
 
@@ -92,7 +102,7 @@ void swap_write_png(const char *name, const guint8 *in, size_t w, size_t h,
                      sizeof GRAY_ICC);
     }
 
-    png_set_write_fn(png_ptr, io, png_write_fn, png_flush_fn);
+    png_set_write_fn(png_ptr, b, png_write_fn, png_flush_fn);
     png_set_IHDR(png_ptr, info_ptr, w, h, 8, color_type,
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
@@ -112,25 +122,38 @@ void swap_write_png(const char *name, const guint8 *in, size_t w, size_t h,
 
   end:
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    g_free(rows);
-    p2sc_free_iofile(io);
+    g_free((void *) rows);
+
+    if (err[0]) {
+        p2sc_buffer_del(b, FALSE);
+        P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "libpng: %s", err);
+    }
+
+    *len = p2sc_buffer_size(b);
+    return p2sc_buffer_del(b, TRUE);
+}
+
+void swap_write_png(const char *name, const guint8 *in, size_t w, size_t h,
+                    swap_palette_t *pal, const char *xml, int strategy) {
+    size_t len;
+    guint8 *buf = swap_encode_png(in, w, h, pal, xml, strategy, &len);
+
+    swap_write_file(name, buf, len);
+    g_free(buf);
 }
 
 struct my_err_mgr {
     struct jpeg_error_mgr pub;
     jmp_buf setjmp_buffer;
+    char msg[JMSG_LENGTH_MAX];
 };
 
+/* reported by the writer once libjpeg state is released */
 static void jpeg_error_exit(j_common_ptr cinfo) {
-    char msg[JMSG_LENGTH_MAX];
-
-    /* fatal, subsequent code will not be executed */
-    cinfo->err->format_message(cinfo, msg);
-    P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "libjpeg: %s", msg);
-/*
     struct my_err_mgr *myerr = (struct my_err_mgr *) cinfo->err;
+
+    cinfo->err->format_message(cinfo, myerr->msg);
     longjmp(myerr->setjmp_buffer, 1);
-*/
 }
 
 static void jpeg_output_msg(j_common_ptr cinfo) {
@@ -241,13 +264,14 @@ jpeg_icc_write_profile(j_compress_ptr cinfo,
     }
 }
 
-void swap_write_jpg(const char *name, const guint8 *in, size_t w, size_t h,
-                    swap_palette_t *pal, int scale, const char *xml) {
+guint8 *swap_encode_jpg(const guint8 *in, size_t w, size_t h,
+                        swap_palette_t *pal, int scale, const char *xml, size_t *len) {
     struct my_err_mgr jerr;
     struct jpeg_compress_struct cinfo;
-    unsigned char *obuff = NULL, *line = NULL;
-    unsigned long osize;
+    unsigned char *volatile obuff = NULL, *volatile line = NULL;
+    unsigned long osize = 0;
 
+    jerr.msg[0] = 0;
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = jpeg_error_exit;
     jerr.pub.output_message = jpeg_output_msg;
@@ -265,7 +289,7 @@ void swap_write_jpg(const char *name, const guint8 *in, size_t w, size_t h,
     }
 
     jpeg_create_compress(&cinfo);
-    jpeg_mem_dest(&cinfo, &obuff, &osize);
+    jpeg_mem_dest(&cinfo, (unsigned char **) &obuff, &osize);
 
     cinfo.input_components = ncomps;
     cinfo.in_color_space = cspace;
@@ -306,57 +330,72 @@ void swap_write_jpg(const char *name, const guint8 *in, size_t w, size_t h,
     }
     jpeg_finish_compress(&cinfo);
 
-    p2sc_iofile_t *io = p2sc_open_iofile(name, "w");
-    p2sc_write(io, (const char *) obuff, osize);
-    p2sc_free_iofile(io);
-
   end:
     jpeg_destroy_compress(&cinfo);
     g_free(line);
-    g_free(obuff);
+
+    if (jerr.msg[0]) {
+        g_free(obuff);
+        P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "libjpeg: %s", jerr.msg);
+    }
+
+    *len = osize;
+    return obuff;
 }
 
-void swap_write_pgm(const char *name, const guint16 *ptr, size_t w, size_t h, guint16 max) {
-    size_t i, len, over = 0;
+void swap_write_jpg(const char *name, const guint8 *in, size_t w, size_t h,
+                    swap_palette_t *pal, int scale, const char *xml) {
+    size_t len;
+    guint8 *buf = swap_encode_jpg(in, w, h, pal, scale, xml, &len);
+
+    swap_write_file(name, buf, len);
+    g_free(buf);
+}
+
+guint8 *swap_encode_pgm(const guint16 *ptr, size_t w, size_t h, guint16 max, size_t *len) {
+    size_t i, n = w * h, over = 0;
     guint16 v;
-    void *buf;
 
-    if (max > 255) {
-        len = 2 * w * h;
-        buf = g_malloc(len);
+    char *head = g_strdup_printf("P5\n%zd %zd\n%hu\n", w, h, max);
+    size_t hlen = strlen(head);
 
-        for (i = 0; i < w * h; ++i) {
+    *len = hlen + (max > 255 ? 2 : 1) * n;
+    guint8 *ret = (guint8 *) g_malloc(*len), *buf = ret + hlen;
+    memcpy(ret, head, hlen);
+    g_free(head);
+
+    if (max > 255) {
+        for (i = 0; i < n; ++i) {
             v = ptr[i];
             if (v > max) {
-                ((guint16 *) buf)[i] = GUINT16_TO_BE(max);
+                v = max;
                 ++over;
-            } else
-                ((guint16 *) buf)[i] = GUINT16_TO_BE(v);
+            }
+            v = GUINT16_TO_BE(v);
+            memcpy(buf + 2 * i, &v, 2);
         }
     } else {
-        len = w * h;
-        buf = g_malloc(len);
-
-        for (i = 0; i < len; ++i) {
+        for (i = 0; i < n; ++i) {
             v = ((const guint8 *) ptr)[i];  /* 1 byte data */
             if (v > max) {
-                ((guint8 *) buf)[i] = max;
+                buf[i] = max;
                 ++over;
             } else
-                ((guint8 *) buf)[i] = v;
+                buf[i] = v;
         }
     }
 
     if (over)
         P2SC_Msg(LVL_WARNING_CORRUPT_INPUT_DATA, "Corrupted image: %zd pixels > %hu", over, max);
 
-    p2sc_iofile_t *io = p2sc_open_iofile(name, "w");
-    char *head = g_strdup_printf("P5\n%zd %zd\n%hu\n", w, h, max);
-    p2sc_write(io, head, strlen(head));
-    p2sc_write(io, (const char *) buf, len);
-    p2sc_free_iofile(io);
+    return ret;
+}
 
-    g_free(head);
+void swap_write_pgm(const char *name, const guint16 *ptr, size_t w, size_t h, guint16 max) {
+    size_t len;
+    guint8 *buf = swap_encode_pgm(ptr, w, h, max, &len);
+
+    swap_write_file(name, buf, len);
     g_free(buf);
 }
 
@@ -20,6 +20,16 @@ extern "C" {
                         swap_palette_t *, int, const char *);
 
     void swap_write_pgm(const char *, const guint16 *, size_t, size_t, guint16);
+
+    /* the same, encoded in memory; the last argument returns the length */
+    guint8 *swap_encode_png(const guint8 *, size_t, size_t,
+                            swap_palette_t *, const char *, int, size_t *);
+    guint8 *swap_encode_jpg(const guint8 *, size_t, size_t,
+                            swap_palette_t *, int, const char *, size_t *);
+    guint8 *swap_encode_pgm(const guint16 *, size_t, size_t, guint16, size_t *);
+
+    /* create or replace, synced to disk */
+    void swap_write_file(const char *, const guint8 *, size_t);
     guint16 *swap_read_pgm(const char *, size_t *, size_t *);
 
     void swap_y4m(const char *, const char *, const guint8 *, size_t, size_t);
@@ -16,7 +16,9 @@ static const char _versionid_[] __attribute__((unused)) =
 #include "opj_index.h"
 
 #include "p2sc_file.h"
+#include "p2sc_msg.h"
 #include "swap_color.h"
+#include "swap_file.h"
 #include "swap_file_j2k.h"
 
 #define J2_DEBUG  0
@@ -26,8 +28,6 @@ static const char _versionid_[] __attribute__((unused)) =
 #define JP2_CFMT  1
 #define JPT_CFMT  2
 
-static void write_data(const char *, const guint8 *, size_t);
-
 static void error_cb(const char *msg, void *client_data) {
     FILE *stream = (FILE *) client_data;
     fprintf(stream, "[ERROR] %s", msg);
@@ -111,8 +111,8 @@ guint8 *swap_read_j2k(const char *name, size_t *ww, size_t *hh, size_t *nc) {
     return ret;
 }
 
-void swap_write_j2k(const char *name, const guint8 *in, size_t w, size_t h,
-                    const swap_j2kparams_t *p) {
+guint8 *swap_encode_j2k(const char *name, const guint8 *in, size_t w, size_t h,
+                        const swap_j2kparams_t *p, size_t *len) {
     int subsampling_dx = 1, subsampling_dy = 1;
 
     opj_event_mgr_t event_mgr;
@@ -183,13 +183,16 @@ void swap_write_j2k(const char *name, const guint8 *in, size_t w, size_t h,
     opj_codestream_info_t cstr_info;
     if (!opj_encode_with_info(cinfo, cio, image, &cstr_info)) {
         opj_cio_close(cio);
-        fprintf(stderr, "failed to encode image\n");
-        return;
+        opj_destroy_compress(cinfo);
+        opj_image_destroy(image);
+        g_free(params.cp_comment);
+        P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "failed to encode image");
     }
 
-    write_data(name, cio->buffer, cio_tell(cio));
+    *len = cio_tell(cio);
+    guint8 *ret = (guint8 *) g_memdup(cio->buffer, *len);
 
-    if (p->debug) {
+    if (name && p->debug) {
         char *idx = g_strdup_printf("%s.%s", name, OPJ_INDEX);
         write_index_file(&cstr_info, idx);
         g_free(idx);
@@ -200,19 +203,15 @@ void swap_write_j2k(const char *name, const guint8 *in, size_t w, size_t h,
     opj_destroy_compress(cinfo);
     opj_image_destroy(image);
     g_free(params.cp_comment);
-}
 
-static void write_data(const char *name, const guint8 *code, size_t code_len) {
-    FILE *f = fopen(name, "wb");
-    if (!f) {
-        fprintf(stderr, "failed to open %s for writing\n", name);
-        return;
-    }
+    return ret;
+}
 
-    if (fwrite(code, 1, code_len, f) < code_len) {  /* FIXME */
-        fprintf(stderr, "failed to write %zd (%s)\n", code_len, name);
-        return;
-    }
+void swap_write_j2k(const char *name, const guint8 *in, size_t w, size_t h,
+                    const swap_j2kparams_t *p) {
+    size_t len;
+    guint8 *buf = swap_encode_j2k(name, in, w, h, p, &len);
 
-    fclose(f);
+    swap_write_file(name, buf, len);
+    g_free(buf);
 }
@@ -28,6 +28,9 @@ extern "C" {
     } swap_j2kparams_t;
 
     void swap_write_j2k(const char *, const guint8 *, size_t, size_t, const swap_j2kparams_t *);
+    /* in memory, the name is only used for the debug index */
+    guint8 *swap_encode_j2k(const char *, const guint8 *, size_t, size_t,
+                            const swap_j2kparams_t *, size_t *);
 
     guint8 *swap_read_j2k(const char *name, size_t *, size_t *, size_t *);
 
@@ -13,6 +13,8 @@ static const char _versionid_[] __attribute__((unused)) =
 #include <math.h>
 #include <glib.h>
 
+#include "p2sc_parallel.h"
+
 #include "swap_math.h"
 #include "swap_vliet.h"
 
@@ -446,20 +448,187 @@ double swap_mse(const float *im1, const float *im2, size_t w, size_t h,
     return mse;
 }
 
+#define EXP_MASK 0x7f800000
+
+/* values per part at least */
+#define MINMAX_MT_MIN (1 << 20)
+
+/* blocks with a NaN or infinity are scanned again, value by value */
+#define MINMAX_BLOCK  4096
+
+typedef struct {
+    const float *in;
+    /* finite values and their range, per part */
+    size_t n[P2SC_PARALLEL_MAX];
+    float mn[P2SC_PARALLEL_MAX], mx[P2SC_PARALLEL_MAX];
+} minmax_t;
+
+/*
+   plain MIN/MAX vectorise, the non-finite values are counted by their bits
+   whatever -ffast-math assumes
+ */
+static void minmax_part(size_t from, size_t to, int part, void *data) {
+    minmax_t *t = (minmax_t *) data;
+    const float *in = t->in;
+    float mn = FLT_MAX, mx = -FLT_MAX;
+    size_t n = 0;
+
+    for (size_t i = from; i < to; i += MINMAX_BLOCK) {
+        size_t k, end = MIN(to, i + MINMAX_BLOCK);
+        float bmn = mn, bmx = mx;
+        guint32 nf = 0;
+
+        for (k = i; k < end; ++k) {
+            guint32 b;
+            memcpy(&b, in + k, sizeof b);
+            bmn = MIN(bmn, in[k]);
+            bmx = MAX(bmx, in[k]);
+            nf += (b & EXP_MASK) == EXP_MASK;
+        }
+
+        if (nf)
+            for (k = i; k < end; ++k) {
+                guint32 b;
+                memcpy(&b, in + k, sizeof b);
+                if ((b & EXP_MASK) != EXP_MASK) {
+                    mn = MIN(mn, in[k]);
+                    mx = MAX(mx, in[k]);
+                }
+            }
+        else
+            mn = bmn, mx = bmx;
+        n += end - i - nf;
+    }
+
+    t->mn[part] = mn, t->mx[part] = mx, t->n[part] = n;
+}
+
+size_t swap_minmax(const float *in, size_t len, float *mn, float *mx) {
+    minmax_t t = {.in = in };
+
+    /* the range of the whole is the range of the parts */
+    int i, n = p2sc_parallel_for(len, MINMAX_MT_MIN, minmax_part, &t);
+    for (i = 1; i < n; ++i) {
+        t.n[0] += t.n[i];
+        t.mn[0] = MIN(t.mn[0], t.mn[i]);
+        t.mx[0] = MAX(t.mx[0], t.mx[i]);
+    }
+
+    if (t.n[0])
+        *mn = t.mn[0], *mx = t.mx[0];
+    return t.n[0];
+}
+
 #define NH 32768
-#define HC(x)   ((size_t) ((NH - 1) * (x - min) / (max - min) + .5))
 
-static void top_quant(float *in, size_t len, float min, float max, double quant) {
-    size_t i, q = 0, qi = (1 - quant) * len + .5;
-    size_t *hist = (size_t *) g_malloc0(NH * sizeof *hist);
-
-    for (i = 0; i < len; ++i)
-        ++hist[HC(in[i])];
-    for (i = 0; i < NH; ++i) {
-        q += hist[i];
-        if (q > qi)
+/* values per part at least */
+#define HIST_MT_MIN (1 << 20)
+
+typedef struct {
+    const void *in;
+    size_t len, nh;
+    float min, max;
+    /* -1 for floats, else 16-bit counts, big-endian if 1 */
+    int be;
+    size_t *hist[P2SC_PARALLEL_MAX];
+} hist_t;
+
+static inline size_t hist_bin(float x, float min, float max, size_t nh) {
+    guint32 b;
+
+    memcpy(&b, &x, sizeof b);
+    if ((b & EXP_MASK) == EXP_MASK)
+        return b & 0x007fffff ? 0 : nh - 1;
+    if (x <= min)
+        return 0;
+    if (x >= max)
+        return nh - 1;
+    return (size_t) ((float) (nh - 1) * (x - min) / (max - min) + .5);
+}
+
+static void hist_part(size_t from, size_t to, int part, void *data) {
+    hist_t *t = (hist_t *) data;
+    size_t i, *hist = t->hist[part] = (size_t *) g_malloc0(t->nh * sizeof *hist);
+
+    if (t->be < 0) {
+        const float *in = (const float *) t->in;
+        for (i = from; i < to; ++i)
+            ++hist[hist_bin(in[i], t->min, t->max, t->nh)];
+    } else {
+        const guint16 *in = (const guint16 *) t->in;
+        if (t->be)
+            for (i = from; i < to; ++i)
+                ++hist[GUINT16_FROM_BE(in[i]) ^ 0x8000];
+        else
+            for (i = from; i < to; ++i)
+                ++hist[in[i] ^ 0x8000];
+    }
+}
+
+static size_t *hist_run(hist_t *t) {
+    /* per-part histograms, merged */
+    int i, n = p2sc_parallel_for(t->len, HIST_MT_MIN, hist_part, t);
+    for (i = 1; i < n; ++i) {
+        for (size_t k = 0; k < t->nh; ++k)
+            t->hist[0][k] += t->hist[i][k];
+        g_free(t->hist[i]);
+    }
+
+    return t->hist[0];
+}
+
+size_t *swap_hist(const float *in, size_t len, float min, float max, size_t nh) {
+    hist_t t = {.in = in,.len = len,.nh = nh,.min = min,.max = max,.be = -1 };
+    return hist_run(&t);
+}
+
+/* first bin above the fraction q of the n values */
+static size_t hist_quant(const size_t *hist, size_t nh, size_t n, double q) {
+    size_t i, c = 0, qi = q * n + .5;
+
+    for (i = 0; i < nh; ++i) {
+        c += hist[i];
+        if (c > qi)
             break;
     }
+    return MIN(i, nh - 1);
+}
+
+void swap_percentile(const float *in, size_t len, float min, float max, double plo, double phi,
+                     float *lo, float *hi) {
+    size_t *hist = swap_hist(in, len, min, max, NH);
+
+    *lo = min + hist_quant(hist, NH, len, plo) * (max - min) / (NH - 1);
+    *hi = min + hist_quant(hist, NH, len, phi) * (max - min) / (NH - 1);
+    g_free(hist);
+}
+
+void swap_percentile16(const gint16 *in, size_t len, int be, double bscale, double bzero,
+                       float min, float max, double plo, double phi, float *lo, float *hi) {
+    hist_t t = {.in = in,.len = len,.nh = 65536,.be = be };
+    size_t *hist = hist_run(&t);
+
+    /* in the order of the values */
+    if (bscale < 0)
+        for (size_t i = 0; i < 32768; ++i) {
+            size_t x = hist[i];
+            hist[i] = hist[65535 - i], hist[65535 - i] = x;
+        }
+
+    int ilo = hist_quant(hist, 65536, len, plo), ihi = hist_quant(hist, 65536, len, phi);
+    if (bscale < 0)
+        ilo = 65535 - ilo, ihi = 65535 - ihi;
+
+    float vlo = bscale * (ilo - 32768) + bzero, vhi = bscale * (ihi - 32768) + bzero;
+    *lo = CLAMP(vlo, min, max);
+    *hi = CLAMP(vhi, min, max);
+    g_free(hist);
+}
+
+static void top_quant(float *in, size_t len, float min, float max, double quant) {
+    size_t i, *hist = swap_hist(in, len, min, max, NH);
+
+    i = hist_quant(hist, NH, len, 1 - quant);
 
     min += i * (max - min) / (NH - 1);
     for (i = 0; i < len; ++i) {
@@ -29,6 +29,20 @@ extern "C" {
 
     double swap_mse(const float *, const float *, size_t, size_t, size_t, size_t, size_t, size_t);
 
+    /* range of the finite values and their number, mn and mx untouched if none */
+    size_t swap_minmax(const float *, size_t, float *, float *);
+
+    /*
+       histogram of n bins over min, max, the values beyond in the end bins,
+       NaN in the first, infinities in the last as by swap_clamp()
+     */
+    size_t *swap_hist(const float *, size_t, float, float, size_t);
+    /* levels below which the fractions plo, phi of the values lie, within min, max */
+    void swap_percentile(const float *, size_t, float, float, double, double, float *, float *);
+    /* the same, exact, on raw 16-bit counts with their BSCALE/BZERO; be for a file view */
+    void swap_percentile16(const gint16 *, size_t, int, double, double, float, float,
+                           double, double, float *, float *);
+
     void swap_bary(const float *, size_t, size_t, float *, float *);
 
 /* ---------------------------------------------------------------------- */
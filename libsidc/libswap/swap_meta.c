@@ -63,6 +63,7 @@ char *swap_fits2hv(sfts_t *f, const char *contact) {
     GENX_Try(w, genxStartElementLiteral(w, NULL, (constUtf8) "HV_COMMENT"));
     {
         char *s_time = p2sc_timestamp(-1, 3);
+        char *title = p2sc_ctx_dup_string(sfts_get_ctx(f), "filename");
         p2sc_xml_addtext(w, "\n"
                          " Title         : %s\n"
                          " Contact       : %s\n"
@@ -70,7 +71,8 @@ char *swap_fits2hv(sfts_t *f, const char *contact) {
                          " Creation Time : %s\n"
                          " Software      : fits2img\n"
                          " Source        : %s\n",
-                         p2sc_get_string("filename"), contact, s_time, g_get_host_name());
+                         title, contact, s_time, g_get_host_name());
+        g_free(title);
         g_free(s_time);
     }
     GENX_Try(w, genxEndElement(w)); /* HV_COMMENT */
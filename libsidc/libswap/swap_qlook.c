@@ -15,6 +15,7 @@ static const char _versionid_[] __attribute__((unused)) =
 #include "swap_math.h"
 #include "swap_qlook.h"
 #include "swap_vliet.h"
+#include "swap_xfer.h"
 
 void swap_denoise(float *out, size_t w, size_t h, int dc, double ns) {
     size_t i, j;
@@ -137,19 +138,21 @@ void swap_clamp(float *out, size_t w, size_t h, float lo, float hi) {
     }
 }
 
-guint8 *swap_xfer_gamma(const float *in, size_t w, size_t h, float lo, float hi, double g) {
-    size_t len = w * h, i;
-    guint8 *out = (guint8 *) g_malloc(len * sizeof *out), *o = out;
+/* -1000000 for the range of the values, one scan for both */
+static void autorange(const float *in, size_t len, float *lo, float *hi) {
+    float mn, mx;
 
-    if (hi == -1000000)
-        for (i = 0; i < len; ++i)
-            if (in[i] > hi)
-                hi = in[i];
+    if ((*hi == -1000000 || *lo == -1000000) && swap_minmax(in, len, &mn, &mx)) {
+        if (*hi == -1000000)
+            *hi = MAX(*hi, mx);
+        if (*lo == -1000000)
+            *lo = MIN(*lo, mn);
+    }
+}
 
-    if (lo == -1000000)
-        for (i = 0; i < len; ++i)
-            if (in[i] < lo)
-                lo = in[i];
+static guint8 *xfer(const float *in, size_t w, size_t h, float lo, float hi, int type, double e) {
+    size_t len = w * h;
+    guint8 *out = (guint8 *) g_malloc(len * sizeof *out);
 
     double r = hi - lo;
     if (r <= 0) {
@@ -157,45 +160,110 @@ guint8 *swap_xfer_gamma(const float *in, size_t w, size_t h, float lo, float hi,
         return out;
     }
 
-    g = CLAMP(g, 1e-6, 1e6);
-    double g1 = 1. / g, pr = 255. / pow(r, g1);
-    for (i = 0; i < len; ++i) {
-        double p = in[i] - lo;
-        p = pow(CLAMP(p, 0, r), g1) * pr + .5;
-        *o++ = CLAMP(p, 0, 255);
-    }
+    swap_xfer_t *x = swap_xfer_new(type, e, lo, hi, len);
+    swap_xfer_run(x, in, out, len);
+    swap_xfer_free(x);
 
     return out;
 }
 
+guint8 *swap_xfer_gamma(const float *in, size_t w, size_t h, float lo, float hi, double g) {
+    autorange(in, w * h, &lo, &hi);
+    return xfer(in, w, h, lo, hi, SWAP_XFER_GAMMA, g);
+}
+
 guint8 *swap_xfer_log(const float *in, size_t w, size_t h, float lo, float hi, double a) {
-    size_t len = w * h, i;
-    guint8 *out = (guint8 *) g_malloc(len * sizeof *out), *o = out;
+    autorange(in, w * h, &lo, &hi);
+    return xfer(in, w, h, lo, hi, SWAP_XFER_LOG, a);
+}
 
-    if (hi == -1000000)
-        for (i = 0; i < len; ++i)
-            if (in[i] > hi)
-                hi = in[i];
+/*
+   after swap_clamp() to lo, hi the -1000000 autoscale of swap_xfer_*() finds
+   lo, hi themselves: nothing to scan, nothing to write back
+ */
+guint8 *swap_clamp_gamma(const float *in, size_t w, size_t h, float lo, float hi, double g) {
+    return xfer(in, w, h, lo, hi, SWAP_XFER_GAMMA, g);
+}
 
-    if (lo == -1000000)
-        for (i = 0; i < len; ++i)
-            if (in[i] < lo)
-                lo = in[i];
+guint8 *swap_clamp_log(const float *in, size_t w, size_t h, float lo, float hi, double a) {
+    return xfer(in, w, h, lo, hi, SWAP_XFER_LOG, a);
+}
+
+/* count i, in FITS byte order for a mapped image */
+#define COUNT16(in, i, be) ((be) ? (gint16) GUINT16_FROM_BE((guint16) (in)[i]) : (in)[i])
+
+/*
+   16-bit raw counts: both swap_clamp() and the transfer through a LUT of all
+   counts; be reads big-endian rows bottom-up, as stored in the file
+ */
+static guint8 *xfer16(const gint16 *in, size_t w, size_t h, double bscale, double bzero,
+                      float lo, float hi, int islog, double e, int be) {
+    size_t len = w * h, i;
+    guint8 *out = (guint8 *) g_malloc(len * sizeof *out);
+    float clo = lo, chi = hi;
+
+    /* the range of the clamped values, as the float path sees it */
+    if (hi == -1000000 || lo == -1000000) {
+        gint16 mn = G_MAXINT16, mx = G_MININT16;
+        for (i = 0; i < len; ++i) {
+            gint16 v = COUNT16(in, i, be);
+            mn = MIN(mn, v);
+            mx = MAX(mx, v);
+        }
+
+        float vmn = bscale * mn + bzero, vmx = bscale * mx + bzero;
+        if (hi == -1000000)
+            hi = MAX(hi, CLAMP(vmx, clo, chi));
+        if (lo == -1000000)
+            lo = MIN(lo, CLAMP(vmn, clo, chi));
+    }
 
     double r = hi - lo;
-    if (r <= 0) {
+    if (r <= 0 || !len) {
         memset(out, 0, len * sizeof *out);
         return out;
     }
 
-    a = CLAMP(a, 1e-6, 1e6);
-    double r1 = 1 / r;
-    double loga1 = 255 / log1p(a);
-    for (i = 0; i < len; ++i) {
-        double p = CLAMP((in[i] - lo) * r1, 0, 1);  // pixel value p is now between 0 and 1
-        p = log1p(p * a) * loga1 + .5;
-        *o++ = CLAMP(p, 0, 255);
+    /* every count exactly, the table is the integer backend */
+    swap_xfer_t *x = swap_xfer_new(islog ? SWAP_XFER_LOG : SWAP_XFER_GAMMA, e, lo, hi, 0);
+    guint8 *lut = (guint8 *) g_malloc(65536);
+    for (i = 0; i < 65536; ++i) {
+        float v = bscale * ((int) i - 32768) + bzero;
+        lut[i] = swap_xfer_value(x, CLAMP(v, clo, chi));
     }
+    swap_xfer_free(x);
+
+    if (be)
+        for (size_t j = 0; j < h; ++j) {
+            const gint16 *r = in + (h - 1 - j) * w;
+            guint8 *o = out + j * w;
+            for (i = 0; i < w; ++i)
+                o[i] = lut[(guint16) COUNT16(r, i, 1) ^ 0x8000];
+        }
+    else
+        for (i = 0; i < len; ++i)
+            out[i] = lut[(guint16) in[i] ^ 0x8000];
+    g_free(lut);
 
     return out;
 }
+
+guint8 *swap_xfer_gamma16(const gint16 *in, size_t w, size_t h, double bscale, double bzero,
+                          float lo, float hi, double g) {
+    return xfer16(in, w, h, bscale, bzero, lo, hi, 0, g, 0);
+}
+
+guint8 *swap_xfer_log16(const gint16 *in, size_t w, size_t h, double bscale, double bzero,
+                        float lo, float hi, double a) {
+    return xfer16(in, w, h, bscale, bzero, lo, hi, 1, a, 0);
+}
+
+guint8 *swap_xfer_gamma16be(const gint16 *in, size_t w, size_t h, double bscale, double bzero,
+                            float lo, float hi, double g) {
+    return xfer16(in, w, h, bscale, bzero, lo, hi, 0, g, 1);
+}
+
+guint8 *swap_xfer_log16be(const gint16 *in, size_t w, size_t h, double bscale, double bzero,
+                          float lo, float hi, double a) {
+    return xfer16(in, w, h, bscale, bzero, lo, hi, 1, a, 1);
+}
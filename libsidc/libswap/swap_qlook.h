@@ -22,6 +22,23 @@ extern "C" {
     void swap_clamp(float *, size_t, size_t, float, float);
     guint8 *swap_xfer_gamma(const float *, size_t, size_t, float, float, double);
     guint8 *swap_xfer_log(const float *, size_t, size_t, float, float, double);
+    /* swap_clamp() then swap_xfer_*() in one pass, the input left as is */
+    guint8 *swap_clamp_gamma(const float *, size_t, size_t, float, float, double);
+    guint8 *swap_clamp_log(const float *, size_t, size_t, float, float, double);
+
+    /*
+       the same on raw 16-bit counts with their BSCALE/BZERO, clamped
+       to lo, hi first as by swap_clamp(); one table lookup per pixel
+     */
+    guint8 *swap_xfer_gamma16(const gint16 *, size_t, size_t, double, double,
+                              float, float, double);
+    guint8 *swap_xfer_log16(const gint16 *, size_t, size_t, double, double,
+                            float, float, double);
+    /* the same on a view of the file: big-endian, bottom row first */
+    guint8 *swap_xfer_gamma16be(const gint16 *, size_t, size_t, double, double,
+                                float, float, double);
+    guint8 *swap_xfer_log16be(const gint16 *, size_t, size_t, double, double,
+                              float, float, double);
 
 /* ---------------------------------------------------------------------- */
 
@@ -4,6 +4,8 @@ static const char _versionid_[] __attribute__((unused)) =
 
 #include <glib.h>
 
+#include "p2sc_parallel.h"
+
 #include "swap_vliet.h"
 
 #define SRCTYPE const float
@@ -14,7 +16,7 @@ static void TriggsM(double *filter, double *M);
 static void xline(SRCTYPE * src, DSTTYPE * dest, int sx, int sy, double *filter);
 static void yline(DSTTYPE * src, DSTTYPE * dest, int sx, int sy, double *filter);
 
-void swap_gauss(SRCTYPE *c, DSTTYPE *b, int w, int h, double s) {
+void swap_gauss_scalar(SRCTYPE *c, DSTTYPE *b, int w, int h, double s) {
     double filter[7];
 
     /* calculate filter coefficients of x-direction */
@@ -89,6 +91,190 @@ static void TriggsM(double *filter, double *M) {
     M[8] = scale * a3 * (a1 + a3 * a2);
 }
 
+/*
+   float engine: the x recursion runs on GV_N rows at once, one per vector
+   lane, the y recursion on whole rows of a column strip; rows and strips
+   are split across threads
+ */
+#define GV_N 8
+typedef float gv_f __attribute__((vector_size(GV_N * sizeof(float))));
+
+/* float error grows with the poles towards 1: ~2e-5 relative at 5, ~2e-3 at 20 */
+#define GAUSS_FLOAT_MAX 5
+
+/* pixels per part at least */
+#define GAUSS_MT_MIN (1 << 18)
+
+typedef struct {
+    /* causal and anti-causal feedback, the same for this filter */
+    float b1, b2, b3;
+    /* B and B^2, 1/(1 - b1 - b2 - b3) computed in double */
+    float sumsq, sum, k;
+    float M[9];
+} coef_t;
+
+typedef struct {
+    SRCTYPE *src;
+    DSTTYPE *dest;
+    int sx, sy;
+    /* rows or columns of this part */
+    int from, to;
+    const coef_t *c;
+} gpart_t;
+
+typedef struct {
+    gpart_t t;
+    void (*func)(const gpart_t *);
+    int len, align;
+} gauss_t;
+
+static void coef_init(coef_t *c, double *filter) {
+    double M[9];
+
+    TriggsM(filter, M);
+    c->b1 = filter[2], c->b2 = filter[1], c->b3 = filter[0];
+    c->sumsq = filter[3], c->sum = filter[3] * filter[3];
+    c->k = 1.0 / (1.0 - filter[2] - filter[1] - filter[0]);
+    for (int i = 0; i < 9; ++i)
+        c->M[i] = M[i];
+}
+
+/*
+   rows from, to, GV_N at a time transposed into one vector per column;
+   lanes beyond the last row repeat it
+ */
+static void xrows(const gpart_t *t) {
+    const coef_t *c = t->c;
+    int sx = t->sx, j, k;
+    gv_f *v = (gv_f *) g_malloc(sx * sizeof *v);
+
+    for (int r = t->from; r < t->to; r += GV_N) {
+        int rows[GV_N];
+        gv_f p1, p2, p3, pix;
+
+        for (k = 0; k < GV_N; ++k) {
+            const float *s = t->src + (size_t) (rows[k] = MIN(r + k, t->to - 1)) * sx;
+            for (j = 0; j < sx; ++j)
+                v[j][k] = s[j];
+        }
+
+        /* causal filter */
+        p1 = v[0] / c->sumsq;
+        p2 = p1, p3 = p1;
+        gv_f iplus = v[sx - 1];
+        for (j = 0; j < sx; ++j) {
+            pix = v[j] + c->b1 * p1 + c->b2 * p2 + c->b3 * p3;
+            v[j] = pix;
+            p3 = p2, p2 = p1, p1 = pix;
+        }
+
+        /* Triggs border condition */
+        gv_f uplus = iplus * c->k, vplus = uplus * c->k;
+        gv_f unp = p1 - uplus, unp1 = p2 - uplus, unp2 = p3 - uplus;
+
+        pix = (c->M[0] * unp + c->M[1] * unp1 + c->M[2] * unp2 + vplus) * c->sum;
+        p2 = (c->M[3] * unp + c->M[4] * unp1 + c->M[5] * unp2 + vplus) * c->sum;
+        p3 = (c->M[6] * unp + c->M[7] * unp1 + c->M[8] * unp2 + vplus) * c->sum;
+        v[sx - 1] = p1 = pix;
+
+        /* anti-causal filter */
+        for (j = sx - 2; j >= 0; --j) {
+            pix = c->sum * v[j] + c->b1 * p1 + c->b2 * p2 + c->b3 * p3;
+            v[j] = pix;
+            p3 = p2, p2 = p1, p1 = pix;
+        }
+
+        for (k = 0; k < GV_N; ++k) {
+            float *d = t->dest + (size_t) rows[k] * sx;
+            for (j = 0; j < sx; ++j)
+                d[j] = v[j][k];
+        }
+    }
+
+    g_free(v);
+}
+
+/* columns from, to of dest, in place */
+static void ycols(const gpart_t *t) {
+    const coef_t *c = t->c;
+    size_t sx = t->sx;
+    int n = t->to - t->from, i, j;
+    float *buf = (float *) g_malloc(5 * n * sizeof *buf);
+    float *p0 = buf, *p1 = buf + n, *p2 = buf + 2 * n, *p3 = buf + 3 * n, *uplus = buf + 4 * n, *ps;
+    DSTTYPE *d = t->dest + t->from, *row;
+
+    /* border first line, last line for the Triggs boundary condition */
+    for (j = 0; j < n; ++j) {
+        p1[j] = p2[j] = p3[j] = d[j] / c->sumsq;
+        uplus[j] = d[(t->sy - 1) * sx + j] * c->k;
+    }
+
+    /* causal filter */
+    for (i = 0; i < t->sy; ++i) {
+        row = d + i * sx;
+        for (j = 0; j < n; ++j)
+            row[j] = p0[j] = row[j] + c->b1 * p1[j] + c->b2 * p2[j] + c->b3 * p3[j];
+        ps = p3, p3 = p2, p2 = p1, p1 = p0, p0 = ps;
+    }
+
+    /* anti-causal filter, first line */
+    row = d + (t->sy - 1) * sx;
+    for (j = 0; j < n; ++j) {
+        float vplus = uplus[j] * c->k;
+        float unp = p1[j] - uplus[j], unp1 = p2[j] - uplus[j], unp2 = p3[j] - uplus[j];
+
+        row[j] = p1[j] = (c->M[0] * unp + c->M[1] * unp1 + c->M[2] * unp2 + vplus) * c->sum;
+        p2[j] = (c->M[3] * unp + c->M[4] * unp1 + c->M[5] * unp2 + vplus) * c->sum;
+        p3[j] = (c->M[6] * unp + c->M[7] * unp1 + c->M[8] * unp2 + vplus) * c->sum;
+    }
+
+    for (i = t->sy - 2; i >= 0; --i) {
+        row = d + i * sx;
+        for (j = 0; j < n; ++j)
+            row[j] = p0[j] = c->sum * row[j] + c->b1 * p1[j] + c->b2 * p2[j] + c->b3 * p3[j];
+        ps = p3, p3 = p2, p2 = p1, p1 = p0, p0 = ps;
+    }
+
+    g_free(buf);
+}
+
+/* blocks of align rows or columns into the rows or columns of a part */
+static void gauss_part(size_t from, size_t to, int part G_GNUC_UNUSED, void *data) {
+    const gauss_t *g = (const gauss_t *) data;
+    gpart_t t = g->t;
+
+    t.from = from * g->align;
+    t.to = MIN(to * g->align, (size_t) g->len);
+    g->func(&t);
+}
+
+static void gauss_run(void (*func)(const gpart_t *), const gpart_t *t, int len, int align) {
+    gauss_t g = {.t = *t,.func = func,.len = len,.align = align };
+    size_t block = (size_t) t->sx * t->sy / len * align;
+
+    /* parts of whole vectors or cache lines */
+    p2sc_parallel_for((len + align - 1) / align, (GAUSS_MT_MIN + block - 1) / block, gauss_part, &g);
+}
+
+void swap_gauss(SRCTYPE *c, DSTTYPE *b, int w, int h, double s) {
+    double filter[7];
+    coef_t coef;
+
+    if (w < 1 || h < 1)
+        return;
+    if (s > GAUSS_FLOAT_MAX) {
+        swap_gauss_scalar(c, b, w, h, s);
+        return;
+    }
+
+    YvVfilterCoef(s, filter);
+    coef_init(&coef, filter);
+
+    gpart_t t = {.src = c,.dest = b,.sx = w,.sy = h,.c = &coef };
+    gauss_run(xrows, &t, h, GV_N);
+    gauss_run(ycols, &t, w, 16);
+}
+
 /**************************************
  * the low level filtering operations *
  **************************************/
@@ -15,6 +15,8 @@ extern "C" {
 /* ---------------------------------------------------------------------- */
 
     void swap_gauss(const float *, float *, int, int, double);
+    /* the same in double precision, one row at a time */
+    void swap_gauss_scalar(const float *, float *, int, int, double);
 
 /* ---------------------------------------------------------------------- */
 
@@ -0,0 +1,185 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <math.h>
+#include <string.h>
+#include <glib.h>
+
+#include "swap_xfer.h"
+
+/*
+   the table is indexed by the top bits of the normalised value as a float:
+   1024 steps per octave from 2^-40 to 1, everything below in the first one
+ */
+#define LUT_BITS  10
+#define LUT_SHIFT (23 - LUT_BITS)
+#define LUT_BASE  ((127 - 40) << LUT_BITS)
+#define LUT_SIZE  ((127 << LUT_BITS) - LUT_BASE + 1)
+
+/* building the table costs about this many exact evaluations */
+#define LUT_MIN   (4 * LUT_SIZE)
+
+/* compiler vectors, whatever the target has */
+#define XV_N 8
+typedef float xv_f __attribute__((vector_size(XV_N * sizeof(float))));
+typedef gint32 xv_i __attribute__((vector_size(XV_N * sizeof(gint32))));
+
+struct swap_xfer_t {
+    int type;
+    /* as the pixel loops always had it */
+    float lo, hi;
+    double r, r1, e, k;
+    /* NULL: exact evaluation of each value */
+    guint8 *lut;
+};
+
+#define EXP_MASK 0x7f800000
+#define MAN_MASK 0x007fffff
+
+/* NaN as lo, infinities as hi, as swap_clamp() has it; by the bits, whatever -ffast-math assumes */
+static inline float sane(const swap_xfer_t *x, float v) {
+    guint32 b;
+
+    memcpy(&b, &v, sizeof b);
+    if ((b & EXP_MASK) == EXP_MASK)
+        return b & MAN_MASK ? x->lo : x->hi;
+    return v;
+}
+
+guint8 swap_xfer_value(const swap_xfer_t *x, float v) {
+    double p;
+
+    v = sane(x, v);
+
+    if (x->type == SWAP_XFER_LOG) {
+        p = CLAMP((v - x->lo) * x->r1, 0, 1);
+        p = log1p(p * x->e) * x->k + .5;
+    } else {
+        p = v - x->lo;
+        p = pow(CLAMP(p, 0, x->r), x->e) * x->k + .5;
+    }
+    return CLAMP(p, 0, 255);
+}
+
+static float bits_float(guint32 b) {
+    float f;
+    memcpy(&f, &b, sizeof f);
+    return f;
+}
+
+/* the value at the middle of each step, none may span more than 1 DN */
+static guint8 *lut_new(const swap_xfer_t *x) {
+    guint8 *lut = (guint8 *) g_malloc(LUT_SIZE);
+    guint8 prev = swap_xfer_value(x, x->lo);
+
+    for (guint32 i = 0; i < LUT_SIZE; ++i) {
+        guint32 b = (guint32) (i + LUT_BASE + 1) << LUT_SHIFT;
+        double phi = i == LUT_SIZE - 1 ? 1 : bits_float(b);
+        double pmid = i ? bits_float(b - (1 << (LUT_SHIFT - 1))) : 0;
+        guint8 hi = swap_xfer_value(x, x->lo + phi * x->r);
+
+        if (hi - prev > 1) {
+            g_free(lut);
+            return NULL;
+        }
+        lut[i] = i == LUT_SIZE - 1 ? hi : swap_xfer_value(x, x->lo + pmid * x->r);
+        prev = hi;
+    }
+    return lut;
+}
+
+swap_xfer_t *swap_xfer_new(int type, double e, float lo, float hi, size_t n) {
+    swap_xfer_t *x = (swap_xfer_t *) g_malloc0(sizeof *x);
+
+    x->type = type;
+    x->lo = lo;
+    x->hi = hi;
+    x->r = hi - lo;
+    x->r1 = 1 / x->r;
+
+    if (type == SWAP_XFER_LOG) {
+        x->e = CLAMP(e, 1e-6, 1e6);
+        x->k = 255 / log1p(x->e);
+    } else {
+        x->e = 1. / CLAMP(e, 1e-6, 1e6);
+        x->k = 255. / pow(x->r, x->e);
+    }
+
+    if (x->r > 0 && n >= LUT_MIN)
+        x->lut = lut_new(x);
+
+    return x;
+}
+
+void swap_xfer_free(swap_xfer_t *x) {
+    if (x) {
+        g_free(x->lut);
+        g_free(x);
+    }
+}
+
+const char *swap_xfer_backend(const swap_xfer_t *x) {
+    return x->lut ? "lut" : "exact";
+}
+
+static inline guint32 lut_index(float p) {
+    guint32 b;
+
+    memcpy(&b, &p, sizeof b);
+    b >>= LUT_SHIFT;
+    return b > LUT_BASE ? b - LUT_BASE : 0;
+}
+
+void swap_xfer_run(const swap_xfer_t *x, const float *in, guint8 *out, size_t len) {
+    size_t i = 0;
+
+    if (!x->lut) {
+        if (x->type == SWAP_XFER_LOG) {
+            for (; i < len; ++i) {
+                double p = CLAMP((sane(x, in[i]) - x->lo) * x->r1, 0, 1);
+                p = log1p(p * x->e) * x->k + .5;
+                out[i] = CLAMP(p, 0, 255);
+            }
+        } else {
+            for (; i < len; ++i) {
+                double p = sane(x, in[i]) - x->lo;
+                p = pow(CLAMP(p, 0, x->r), x->e) * x->k + .5;
+                out[i] = CLAMP(p, 0, 255);
+            }
+        }
+        return;
+    }
+
+    const float r1 = x->r1;
+    const xv_f zero = { 0 }, one = zero + 1;
+    const xv_i base = (xv_i) { 0 } + LUT_BASE;
+
+    /* normalised, clamped to [0, 1], non-finite lanes patched, then indexes */
+    for (; i + XV_N <= len; i += XV_N) {
+        xv_i bits;
+        memcpy(&bits, in + i, sizeof bits);
+
+        xv_i nf = (bits & EXP_MASK) == EXP_MASK;
+        xv_i inf = nf & ((bits & MAN_MASK) == 0);
+
+        xv_f v = ((xv_f) bits - x->lo) * r1;
+        v = (xv_f) ((xv_i) v & (v > zero));
+        xv_i m = v < one;
+        v = (xv_f) (((xv_i) v & m & ~nf) | ((xv_i) one & ((~m & ~nf) | inf)));
+
+        xv_i b = ((xv_i) v >> LUT_SHIFT) - base;
+        b &= b > 0;
+        for (int k = 0; k < XV_N; ++k)
+            out[i + k] = x->lut[b[k]];
+    }
+
+    for (; i < len; ++i) {
+        float p = (sane(x, in[i]) - x->lo) * r1;
+        p = p > 0 ? p : 0;
+        out[i] = x->lut[lut_index(p < 1 ? p : 1)];
+    }
+}
@@ -0,0 +1,38 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+#ifndef __SWAP_XFER_H__
+#define __SWAP_XFER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+    enum { SWAP_XFER_GAMMA, SWAP_XFER_LOG };
+
+    typedef struct swap_xfer_t swap_xfer_t;
+
+    /*
+       transfer of lo, hi to 0, 255 with the gamma or log exponent; for n
+       values or more a table is used if it stays within 1 DN everywhere
+     */
+    swap_xfer_t *swap_xfer_new(int, double, float, float, size_t);
+    void swap_xfer_free(swap_xfer_t *);
+
+    /* exact, as by pow() or log1p(); NaN is taken as lo, infinities as hi */
+    guint8 swap_xfer_value(const swap_xfer_t *, float);
+    void swap_xfer_run(const swap_xfer_t *, const float *, guint8 *, size_t);
+
+    /* "lut" or "exact" */
+    const char *swap_xfer_backend(const swap_xfer_t *);
+
+/* ---------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,473 @@
+/* This file is part of the PROBA2 Science Operations Center software.
+ * Copyright (C) 2007-2014 Royal Observatory of Belgium.
+ * For copying permission, see the file COPYING in the distribution.
+ */
+
+static const char _versionid_[] __attribute__((unused)) = "$Id$";
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <fitsio.h>
+#include <zlib.h>
+
+#include "p2sc_fits.h"
+#include "p2sc_msg.h"
+#include "p2sc_stdlib.h"
+#include "p2sc_sum.h"
+
+#include "fitsproc.h"
+#include "swap_color.h"
+#include "swap_file.h"
+#include "swap_file_j2k.h"
+#include "swap_math.h"
+#include "swap_qlook.h"
+#include "swap_vliet.h"
+#include "swap_warp.h"
+#include "swap_xfer.h"
+
+#define APP_NAME "swap_bench"
+
+#define DEF_SIZES  "1024,2048,4096,8192"
+#define DEF_REPEAT 5
+#define DEF_SEED   20140101
+
+/* the polar LUT is 16 bytes per input pixel */
+#define MAX_POLAR  4096
+
+typedef struct {
+    size_t w, h;
+    /* synthetic input and the 8-bit image made from it */
+    const float *im;
+    const guint8 *g;
+    /* scratch, refreshed from im before each run */
+    float *work;
+    const char *fits;
+    /* the same, gzipped */
+    const char *gz;
+} bench_t;
+
+typedef void (*kernel_t)(bench_t *);
+
+/* solar-like: limb-darkened disk, off-limb corona, shot noise and hot pixels */
+static float *synth(size_t w, size_t h, guint32 seed) {
+    float *im = (float *) g_malloc(w * h * sizeof *im);
+    GRand *r = g_rand_new_with_seed(seed);
+    double xc = (w - 1) / 2., yc = (h - 1) / 2., R = 0.4 * MIN(w, h);
+
+    for (size_t j = 0; j < h; ++j)
+        for (size_t i = 0; i < w; ++i) {
+            double d = hypot(i - xc, j - yc) / R, v;
+
+            if (d < 1)
+                v = 2000 * (0.4 + 0.6 * sqrt(1 - d * d));
+            else
+                v = 2500 * exp(-8 * (d - 1)) + 20 / (d * d);
+            /* gaussian approximation of the photon noise */
+            v += sqrt(v) * (g_rand_double(r) + g_rand_double(r) + g_rand_double(r) - 1.5) * 2;
+            im[j * w + i] = v < 0 ? 0 : v;
+        }
+
+    for (size_t n = w * h / 10000; n; --n)
+        im[g_rand_int_range(r, 0, w * h)] = 16383;
+
+    g_rand_free(r);
+    return im;
+}
+
+static void fresh(bench_t *b) {
+    memcpy(b->work, b->im, b->w * b->h * sizeof *b->work);
+}
+
+static void k_clamp(bench_t *b) {
+    swap_clamp(b->work, b->w, b->h, 0, 8191);
+}
+
+static void k_minmax(bench_t *b) {
+    float mn, mx;
+    swap_minmax(b->work, b->w * b->h, &mn, &mx);
+}
+
+static void k_percentile(bench_t *b) {
+    float lo, hi;
+    swap_percentile(b->work, b->w * b->h, 0, 8191, 0.01, 0.999, &lo, &hi);
+}
+
+static void k_gamma(bench_t *b) {
+    g_free(swap_xfer_gamma(b->work, b->w, b->h, 0, 8191, 2.2));
+}
+
+static void k_log(bench_t *b) {
+    g_free(swap_xfer_log(b->work, b->w, b->h, 0, 8191, 1000));
+}
+
+/* clamp and transfer in one pass, as fits2img does them */
+static void k_clamp_gamma(bench_t *b) {
+    g_free(swap_clamp_gamma(b->work, b->w, b->h, 0, 8191, 2.2));
+}
+
+/* the same without the table */
+static void xfer_exact(bench_t *b, int type, double e) {
+    size_t len = b->w * b->h;
+    guint8 *out = (guint8 *) g_malloc(len);
+    swap_xfer_t *x = swap_xfer_new(type, e, 0, 8191, 0);
+
+    swap_xfer_run(x, b->work, out, len);
+    swap_xfer_free(x);
+    g_free(out);
+}
+
+static void k_gamma_exact(bench_t *b) {
+    xfer_exact(b, SWAP_XFER_GAMMA, 2.2);
+}
+
+static void k_log_exact(bench_t *b) {
+    xfer_exact(b, SWAP_XFER_LOG, 1000);
+}
+
+static void k_crispen(bench_t *b) {
+    swap_crispen(b->work, b->w, b->h);
+}
+
+static void k_denoise(bench_t *b) {
+    swap_denoise(b->work, b->w, b->h, 1, 3);
+}
+
+static void k_gauss(bench_t *b) {
+    float *out = (float *) g_malloc(b->w * b->h * sizeof *out);
+    swap_gauss(b->work, out, b->w, b->h, 2);
+    g_free(out);
+}
+
+static void k_gauss_scalar(bench_t *b) {
+    float *out = (float *) g_malloc(b->w * b->h * sizeof *out);
+    swap_gauss_scalar(b->work, out, b->w, b->h, 2);
+    g_free(out);
+}
+
+static void k_affine(bench_t *b) {
+    swap_bicubic_t *f = swap_bicubic_alloc(0, 0.5);
+    g_free(swap_affine(f, b->work, b->w, b->h, 1.01, 1.01, 0.1, 1.5, -2.5, 0, b->w, b->h));
+    swap_bicubic_free(f);
+}
+
+static void k_polar(bench_t *b) {
+    /* off-centre, the cached LUT of the default geometry is not used */
+    g_free(swap_polar(b->work, b->w, b->h, 1024, 1448, (b->w - 1) / 2. + .25, (b->h - 1) / 2.));
+}
+
+static void k_rebin(bench_t *b) {
+    g_free(swap_rebin(b->work, b->w, b->h, 4, 4));
+}
+
+static void k_madmax(bench_t *b) {
+    g_free(swap_madmax(b->work, b->w, b->h));
+}
+
+static void k_j2k(bench_t *b) {
+    swap_j2kparams_t p = {
+        .cratio = 3.3,.nlayers = 4,.nresolutions = 6,.precinct = { 128, 128 },
+        .meta = {.xml = NULL,.pal = swap_palette_rgb_get("aia171") }
+    };
+    size_t len;
+    g_free(swap_encode_j2k("bench.jp2", b->g, b->w, b->h, &p, &len));
+}
+
+static void k_png(bench_t *b) {
+    size_t len;
+    g_free(swap_encode_png(b->g, b->w, b->h, swap_palette_rgb_get("aia171"), NULL, 3, &len));
+}
+
+static void k_jpg(bench_t *b) {
+    size_t len;
+    g_free(swap_encode_jpg(b->g, b->w, b->h, swap_palette_rgb_get("aia171"), 75, NULL, &len));
+}
+
+static void k_fitsproc(bench_t *b) {
+    procfits_t *p = fitsproc(b->fits, "bench", 0, NULL, NULL, NULL, NULL, NULL);
+    procfits_free(p);
+}
+
+/* the float image as bytes, memory bandwidth bound */
+static void k_sum(bench_t *b) {
+    volatile guint32 sum = p2sc_fits_sum_mt(b->work, b->w * b->h * sizeof *b->work, 0);
+    (void) sum;
+}
+
+static void k_sum_scalar(bench_t *b) {
+    volatile guint32 sum = p2sc_fits_sum_scalar(b->work, b->w * b->h * sizeof *b->work, 0);
+    (void) sum;
+}
+
+static void k_verify(bench_t *b) {
+    g_free(sfts_free(sfts_openro(b->fits, 0)));
+}
+
+/* the same with the cfitsio implementation */
+static void k_verify_cfitsio(bench_t *b) {
+    fitsfile *f;
+    int s = 0, num = 0, dataok, hduok;
+
+    fits_open_file(&f, b->fits, READONLY, &s);
+    fits_get_num_hdus(f, &num, &s);
+    for (int i = 1; i <= num; ++i) {
+        fits_movabs_hdu(f, i, NULL, &s);
+        fits_verify_chksum(f, &dataok, &hduok, &s);
+    }
+    fits_close_file(f, &s);
+    if (s)
+        P2SC_Msg(LVL_FATAL_FITS, "FITS: cfitsio error %d: %s", s, b->fits);
+}
+
+static void k_gunzip(bench_t *b) {
+    g_free(sfts_free(sfts_openro(b->gz, SFTS_SUM_NOVERIFY)));
+}
+
+/* inflated by cfitsio */
+static void k_gunzip_cfitsio(bench_t *b) {
+    fitsfile *f;
+    int s = 0;
+
+    fits_open_file(&f, b->gz, READONLY, &s);
+    fits_close_file(f, &s);
+    if (s)
+        P2SC_Msg(LVL_FATAL_FITS, "FITS: cfitsio error %d: %s", s, b->gz);
+}
+
+static const struct {
+    const char *name;
+    kernel_t func;
+} kernels[] = {
+    { "clamp", k_clamp },
+    { "minmax", k_minmax },
+    { "percentile", k_percentile },
+    { "xfer_gamma", k_gamma },
+    { "xfer_log", k_log },
+    { "xfer_gamma_exact", k_gamma_exact },
+    { "clamp_gamma", k_clamp_gamma },
+    { "xfer_log_exact", k_log_exact },
+    { "crispen", k_crispen },
+    { "denoise", k_denoise },
+    { "gauss", k_gauss },
+    { "gauss_scalar", k_gauss_scalar },
+    { "affine", k_affine },
+    { "polar", k_polar },
+    { "rebin", k_rebin },
+    { "madmax", k_madmax },
+    { "encode_j2k", k_j2k },
+    { "encode_png", k_png },
+    { "encode_jpg", k_jpg },
+    { "fitsproc", k_fitsproc },
+    { "fits_sum", k_sum },
+    { "fits_sum_scalar", k_sum_scalar },
+    { "verify", k_verify },
+    { "verify_cfitsio", k_verify_cfitsio },
+    { "gunzip", k_gunzip },
+    { "gunzip_cfitsio", k_gunzip_cfitsio }
+};
+
+/* 16-bit integer FITS with the keywords fitsproc() needs, checksummed */
+static char *write_fits(const char *dir, const float *im, size_t w, size_t h) {
+    char *name = g_strdup_printf("%s/swap_bench_%d_%zux%zu.fits", dir, (int) getpid(), w, h);
+    gint16 *pix = (gint16 *) g_malloc(w * h * sizeof *pix);
+
+    for (size_t i = 0; i < w * h; ++i)
+        pix[i] = im[i] > G_MAXINT16 ? G_MAXINT16 : im[i];
+
+    unlink(name);
+    sfts_t *f = sfts_create(name, NULL);
+    sfts_create_image(f, w, h, SINT16);
+    sfts_write_image(f, pix, w, h, SINT16);
+
+    sfkey_t k = {.t = 'S' };
+    k.k = "DATE-OBS", k.v.s = (char *) "2014-01-01T00:00:00.000", sfts_write_key(f, &k);
+    k.k = "TELESCOP", k.v.s = (char *) "PROBA2", sfts_write_key(f, &k);
+    k.k = "INSTRUME", k.v.s = (char *) "SWAP", sfts_write_key(f, &k);
+    k.k = "DETECTOR", k.v.s = (char *) "SWAP", sfts_write_key(f, &k);
+    k.k = "WAVELNTH", k.v.s = (char *) "174", sfts_write_key(f, &k);
+
+    char *ret = sfts_free(f);
+    g_free(pix);
+    g_free(name);
+
+    return ret;
+}
+
+static char *write_gz(const char *fits) {
+    char *name = g_strdup_printf("%s.gz", fits), *buf;
+    gsize len;
+
+    if (!g_file_get_contents(fits, &buf, &len, NULL))
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "%s: cannot read", fits);
+
+    gzFile z = gzopen(name, "wb6");
+    if (!z || gzwrite(z, buf, len) != (int) len || gzclose(z) != Z_OK)
+        P2SC_Msg(LVL_FATAL_FILESYSTEM, "%s: cannot write", name);
+    g_free(buf);
+
+    return name;
+}
+
+/* the table against the exact transfer over a sweep of exponents and ranges */
+static int check_xfer(const float *im, size_t w, size_t h) {
+    static const double gamma[] = { 0.25, 0.5, 1, 1.5, 2.2, 3, 4, 10 };
+    static const double alpha[] = { 1e-3, 1, 10, 100, 1000, 1e4, 1e6 };
+    static const float range[][2] = { {0, 8191}, {-100, 300}, {100, 16383} };
+    size_t len = w * h;
+    guint8 *out = (guint8 *) g_malloc(len);
+    int worst = 0;
+
+    for (int t = 0; t < 2; ++t) {
+        int type = t ? SWAP_XFER_LOG : SWAP_XFER_GAMMA;
+        const double *e = t ? alpha : gamma;
+        size_t ne = t ? G_N_ELEMENTS(alpha) : G_N_ELEMENTS(gamma);
+
+        for (size_t k = 0; k < ne; ++k)
+            for (size_t r = 0; r < G_N_ELEMENTS(range); ++r) {
+                swap_xfer_t *x = swap_xfer_new(type, e[k], range[r][0], range[r][1], len);
+                int d = 0;
+
+                swap_xfer_run(x, im, out, len);
+                for (size_t i = 0; i < len; ++i)
+                    d = MAX(d, abs(out[i] - swap_xfer_value(x, im[i])));
+                printf("%5zux%-5zu xfer_%-7s %8g [%g, %g] %-5s max %d DN\n", w, h,
+                       t ? "log" : "gamma", e[k], range[r][0], range[r][1], swap_xfer_backend(x), d);
+                worst = MAX(worst, d);
+                swap_xfer_free(x);
+            }
+    }
+    fflush(stdout);
+
+    g_free(out);
+    return worst;
+}
+
+static int compare_times(const void *a, const void *b) {
+    gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+    return (x > y) - (x < y);
+}
+
+/* one warm-up run, then repeat timed runs on a fresh copy of the input */
+static void run(bench_t *b, const char *name, kernel_t func, int repeat) {
+    gint64 *t = g_new(gint64, repeat);
+
+    fresh(b);
+    func(b);
+    for (int i = 0; i < repeat; ++i) {
+        fresh(b);
+        gint64 t0 = g_get_monotonic_time();
+        func(b);
+        t[i] = g_get_monotonic_time() - t0;
+    }
+    qsort(t, repeat, sizeof *t, compare_times);
+
+    double mpix = b->w * b->h / 1e6;
+    printf("%5zux%-5zu %-12s min %10.3fms  median %10.3fms  %9.2f Mpix/s\n",
+           b->w, b->h, name, t[0] / 1e3, t[repeat / 2] / 1e3,
+           t[0] > 0 ? mpix / (t[0] / 1e6) : 0.);
+    fflush(stdout);
+
+    g_free(t);
+}
+
+static int selected(char **only, const char *name) {
+    if (!only)
+        return 1;
+    for (char **o = only; *o; ++o)
+        if (!strcmp(*o, name))
+            return 1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int repeat = DEF_REPEAT, seed = DEF_SEED, check = 0, worst = 0;
+    char *sizes = NULL, *only = NULL, *tmpdir = NULL;
+
+    GOptionEntry entries[] = {
+        { "sizes", 's', 0, G_OPTION_ARG_STRING, &sizes,
+         "Comma separated square image sizes", DEF_SIZES },
+        { "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat,
+         "Timed runs per kernel, the minimum and median are reported", G_STRINGIFY(DEF_REPEAT) },
+        { "seed", 0, 0, G_OPTION_ARG_INT, &seed,
+         "Seed of the synthetic images", G_STRINGIFY(DEF_SEED) },
+        { "kernels", 'k', 0, G_OPTION_ARG_STRING, &only,
+         "Comma separated subset of: clamp, minmax, percentile, xfer_gamma, xfer_log, "
+         "xfer_gamma_exact, xfer_log_exact, clamp_gamma, crispen, denoise, gauss, gauss_scalar, "
+         "affine, polar, rebin, madmax, encode_j2k, encode_png, encode_jpg, fitsproc, fits_sum, "
+         "fits_sum_scalar, verify, verify_cfitsio, gunzip, gunzip_cfitsio", "all" },
+        { "check-xfer", 0, 0, G_OPTION_ARG_NONE, &check,
+         "Compare the transfer tables to the exact functions, fail beyond 1 DN", NULL },
+        { "tmp-dir", 0, 0, G_OPTION_ARG_STRING, &tmpdir,
+         "Directory of the FITS file of the fitsproc and verify round trips", "/dev/shm" },
+        { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+    };
+
+    p2sc_option_ext(0, &argc, &argv, APP_NAME, "- SWAP kernel benchmarks",
+                    "This program times the libswap kernels on synthetic solar images", entries);
+
+    if (repeat < 1)
+        P2SC_Msg(LVL_FATAL_ARGUMENTS, "--repeat must be at least 1");
+    if (!tmpdir)
+        tmpdir = g_strdup(access("/dev/shm", W_OK) ? g_get_tmp_dir() : "/dev/shm");
+
+    char **sv = g_strsplit(sizes ? sizes : DEF_SIZES, ",", 0);
+    char **kv = only ? g_strsplit(only, ",", 0) : NULL;
+
+    printf("checksum kernel: %s\n", p2sc_fits_sum_kernel());
+
+    for (char **s = sv; *s; ++s) {
+        size_t n = strtoul(*s, NULL, 10);
+        if (n < 16)
+            P2SC_Msg(LVL_FATAL_ARGUMENTS, "%s: bad image size", *s);
+
+        float *im = synth(n, n, seed);
+        bench_t b = {.w = n,.h = n,.im = im };
+
+        if (check) {
+            worst = MAX(worst, check_xfer(im, n, n));
+            g_free(im);
+            continue;
+        }
+
+        b.work = (float *) g_malloc(n * n * sizeof *b.work);
+        b.g = swap_xfer_gamma(im, n, n, 0, 8191, 2.2);
+        int gz = selected(kv, "gunzip") || selected(kv, "gunzip_cfitsio");
+        b.fits = gz || selected(kv, "fitsproc") || selected(kv, "verify") ||
+            selected(kv, "verify_cfitsio") ? write_fits(tmpdir, im, n, n) : NULL;
+        b.gz = gz ? write_gz(b.fits) : NULL;
+
+        for (size_t k = 0; k < G_N_ELEMENTS(kernels); ++k) {
+            if (!selected(kv, kernels[k].name))
+                continue;
+            if (kernels[k].func == k_polar && n > MAX_POLAR) {
+                printf("%5zux%-5zu %-12s skipped, larger than %d\n", n, n, kernels[k].name, MAX_POLAR);
+                continue;
+            }
+            run(&b, kernels[k].name, kernels[k].func, repeat);
+        }
+
+        if (b.gz) {
+            unlink(b.gz);
+            g_free((char *) b.gz);
+        }
+        if (b.fits) {
+            unlink(b.fits);
+            g_free((char *) b.fits);
+        }
+        g_free((guint8 *) b.g);
+        g_free(b.work);
+        g_free(im);
+    }
+
+    g_strfreev(kv);
+    g_strfreev(sv);
+    g_free(sizes), g_free(only), g_free(tmpdir);
+
+    if (worst > 1)
+        P2SC_Msg(LVL_FATAL_INTERNAL_ERROR, "transfer tables off by %d DN", worst);
+
+    return 0;
+}